@@ -0,0 +1,197 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "proton/message.h"
+#include "proton/messenger.h"
+
+#include "allocwatch.h"
+
+/*
+** glibc exports its allocator under these names as well, which lets the
+** replacements forward to it without dlsym(); dlsym() itself allocates.
+** Every way of getting a block that free() accepts is replaced, so that
+** each counted free has a counted allocation.
+*/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *block, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *block);
+
+/* Counts go here until the shared counters are mapped */
+static allocStats early;
+static allocStats *stats = &early;
+
+#define COUNT(field)	__sync_fetch_and_add(&stats->field, 1)
+
+
+__attribute__((constructor)) static void allocWatchInit(void)
+{
+    const char *fileName = getenv(ALLOCWATCH_ENV);
+    if (NULL == fileName)
+    {
+        return;
+    }
+    int fd = open(fileName, O_RDWR);
+    if (fd < 0)
+    {
+        return;
+    }
+    void *shared = mmap(NULL, sizeof(allocStats), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared != MAP_FAILED)
+    {
+        memcpy(shared, &early, sizeof(allocStats));
+        stats = (allocStats *)shared;
+    }
+}
+
+
+void *malloc(size_t size)
+{
+    COUNT(allocations);
+    return __libc_malloc(size);
+}
+
+
+void *calloc(size_t count, size_t size)
+{
+    COUNT(allocations);
+    return __libc_calloc(count, size);
+}
+
+
+void *realloc(void *block, size_t size)
+{
+    if (NULL == block)
+    {
+        COUNT(allocations);
+    }
+    else if (0 == size)
+    {
+        COUNT(frees);
+    }
+    else
+    {
+        COUNT(reallocs);
+    }
+    return __libc_realloc(block, size);
+}
+
+
+void *reallocarray(void *block, size_t count, size_t size)
+{
+    if ((size != 0) && (count > SIZE_MAX / size))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(block, count * size);
+}
+
+
+void *memalign(size_t alignment, size_t size)
+{
+    COUNT(allocations);
+    return __libc_memalign(alignment, size);
+}
+
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    COUNT(allocations);
+    return __libc_memalign(alignment, size);
+}
+
+
+int posix_memalign(void **block, size_t alignment, size_t size)
+{
+    if ((0 == alignment) || ((alignment & (alignment - 1)) != 0) ||
+        ((alignment % sizeof(void *)) != 0))
+    {
+        return EINVAL;
+    }
+    void *result = __libc_memalign(alignment, size);
+    if (NULL == result)
+    {
+        return ENOMEM;
+    }
+    COUNT(allocations);
+    *block = result;
+    return 0;
+}
+
+
+void *valloc(size_t size)
+{
+    COUNT(allocations);
+    return __libc_valloc(size);
+}
+
+
+void *pvalloc(size_t size)
+{
+    COUNT(allocations);
+    return __libc_pvalloc(size);
+}
+
+
+void free(void *block)
+{
+    if (block != NULL)
+    {
+        COUNT(frees);
+    }
+    __libc_free(block);
+}
+
+
+int pn_messenger_put(pn_messenger_t *messenger, pn_message_t *message)
+{
+    static int (*next)(pn_messenger_t *, pn_message_t *) = NULL;
+    if (NULL == next)
+    {
+        next = (int (*)(pn_messenger_t *, pn_message_t *))
+            dlsym(RTLD_NEXT, "pn_messenger_put");
+    }
+    COUNT(messages);
+    return next(messenger, message);
+}
+
+
+int pn_messenger_get(pn_messenger_t *messenger, pn_message_t *message)
+{
+    static int (*next)(pn_messenger_t *, pn_message_t *) = NULL;
+    if (NULL == next)
+    {
+        next = (int (*)(pn_messenger_t *, pn_message_t *))
+            dlsym(RTLD_NEXT, "pn_messenger_get");
+    }
+    COUNT(messages);
+    return next(messenger, message);
+}
@@ -0,0 +1,40 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __ALLOCWATCH_H
+#define __ALLOCWATCH_H
+
+/*
+** liballocwatch.so is loaded into the sender or receiver with LD_PRELOAD
+** by the soak test. It replaces malloc(), calloc(), realloc(), free() and
+** the aligned allocators with versions that count their calls before
+** handing them to glibc, and wraps pn_messenger_put() and
+** pn_messenger_get() to count messages. The counters live in the file
+** named by ALLOCWATCH_ENV, mapped shared, so the soak driver reads them
+** while the process runs without it doing any I/O of its own.
+*/
+#define ALLOCWATCH_ENV		"ALLOCWATCH_FILE"
+
+typedef struct allocStats
+{
+    volatile long long allocations;  /* malloc, calloc, realloc(NULL),
+                                        and the aligned allocators */
+    volatile long long reallocs;     /* realloc of an existing block */
+    volatile long long frees;        /* free and realloc to size 0 */
+    volatile long long messages;     /* pn_messenger_put and _get calls */
+} allocStats;
+
+#endif /* __ALLOCWATCH_H */
@@ -26,6 +26,8 @@
 #include <rpc.h>
 #else
 #include <uuid/uuid.h>
+#include <sys/time.h>
+#include <time.h>
 #endif
 
 #include "common.h"
@@ -89,10 +91,10 @@ void generateUuid(pn_uuid_t *pGenerated)
 }
 
 
-void outputUuid(pn_uuid_t *pUuid)
+void formatUuid(pn_uuid_t *pUuid, char *buffer)
 {
-    printf("%02x%02x%02x%02x-%02x%02x-%02x%02x-"
-        "%02x%02x%02x%02x%02x%02x%02x%02x\n",
+    SNPRINTF(buffer, UUID_STRING_SIZE, "%02x%02x%02x%02x-%02x%02x-%02x%02x-"
+        "%02x%02x%02x%02x%02x%02x%02x%02x",
         ((int)pUuid->bytes[0] & 0x00FF),
         ((int)pUuid->bytes[1] & 0x00FF),
         ((int)pUuid->bytes[2] & 0x00FF),
@@ -113,6 +115,54 @@ void outputUuid(pn_uuid_t *pUuid)
 }
 
 
+void outputUuid(pn_uuid_t *pUuid)
+{
+    char buffer[UUID_STRING_SIZE];
+    formatUuid(pUuid, buffer);
+    printf("%s\n", buffer);
+}
+
+
+/*
+** Positions the cursor of an application properties map on the value for
+** the given key. Returns false if the map is empty or the key is absent.
+** The cursor is left inside the map, so callers should read the value
+** right away and rewind before walking the map again.
+*/
+bool findProperty(pn_data_t *properties, const char *key)
+{
+    size_t keyLength = strlen(key);
+
+    pn_data_rewind(properties);
+    if (!pn_data_next(properties) || (pn_data_type(properties) != PN_MAP))
+    {
+        return false;
+    }
+    pn_data_enter(properties);
+    while (pn_data_next(properties))
+    {
+        bool match = false;
+        if ((PN_STRING == pn_data_type(properties)) ||
+            (PN_SYMBOL == pn_data_type(properties)))
+        {
+            pn_bytes_t name = pn_data_get_bytes(properties);
+            match = (name.size == keyLength) &&
+                (0 == memcmp(name.start, key, keyLength));
+        }
+        if (!pn_data_next(properties))
+        {
+            break;
+        }
+        if (match)
+        {
+            return true;
+        }
+    }
+    pn_data_rewind(properties);
+    return false;
+}
+
+
 char *urlEncodeKey(const char *key)
 {
     char *retval = (char *)malloc(512); // overkill
@@ -152,3 +202,154 @@ char *urlEncodeKey(const char *key)
     *outKey = '\0';
     return retval;
 }
+
+
+/*
+** Wall-clock time in milliseconds since the Unix epoch, which is also
+** the representation of an AMQP timestamp.
+*/
+pn_timestamp_t currentTime(void)
+{
+    return (pn_timestamp_t)(currentTimeMicros() / 1000);
+}
+
+
+/*
+** Wall-clock time in microseconds since the Unix epoch. Use this rather
+** than currentMicros() for timestamps compared across machines.
+*/
+long long currentTimeMicros(void)
+{
+#ifdef _WIN32
+    FILETIME ft;
+    ULARGE_INTEGER t;
+    GetSystemTimeAsFileTime(&ft);
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    /* FILETIME counts 100ns intervals since 1601-01-01 */
+    return (long long)((t.QuadPart - 116444736000000000ULL) / 10);
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return ((long long)now.tv_sec * 1000000) + now.tv_usec;
+#endif
+}
+
+
+/*
+** Monotonic time in microseconds, for measuring intervals. Unlike
+** currentTime() this does not jump when the system clock is adjusted.
+*/
+long long currentMicros(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (long long)((counter.QuadPart * 1000000.0) / frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((long long)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+#endif
+}
+
+
+void sleepMicros(long long micros)
+{
+    if (micros <= 0)
+    {
+        return;
+    }
+#ifdef _WIN32
+    /* Sleep() only has millisecond resolution; round up */
+    Sleep((DWORD)((micros + 999) / 1000));
+#else
+    struct timespec delay;
+    delay.tv_sec = (time_t)(micros / 1000000);
+    delay.tv_nsec = (long)((micros % 1000000) * 1000);
+    nanosleep(&delay, NULL);
+#endif
+}
+
+
+/*
+** True once a sent message has an outcome that cannot change any more.
+** PENDING and UNKNOWN both mean the outcome is still to come, which is
+** how checkTracking() in sender.c treats them.
+*/
+bool isFinalStatus(pn_status_t status)
+{
+    switch (status)
+    {
+    case PN_STATUS_ACCEPTED:
+    case PN_STATUS_REJECTED:
+#if (PN_VERSION_MINOR > 4)
+    case PN_STATUS_MODIFIED:
+#endif
+#if (PN_VERSION_MINOR > 5)
+    case PN_STATUS_RELEASED:
+    case PN_STATUS_ABORTED:
+    case PN_STATUS_SETTLED:
+#endif
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+
+/*
+** Sends everything queued on the messenger, checks the outcome of the
+** count messages in trackers and settles them. A message still PENDING
+** after a blocking send was never acknowledged (see checkTracking() in
+** sender.c), so only ACCEPTED counts as success. Each outcome is stored
+** in statuses and any send error in sendError, if they are given.
+** Returns the number of messages the broker did not accept.
+*/
+int flushTracked(pn_messenger_t *messenger, pn_tracker_t *trackers,
+                 int count, pn_status_t *statuses, int *sendError)
+{
+    int failures = 0;
+    int i;
+
+#if (PN_VERSION_MINOR == 4)
+    int err = pn_messenger_send(messenger);
+#else
+    int err = pn_messenger_send(messenger, -1);
+#endif
+    if ((err != 0) && (err != PN_INPROGRESS))
+    {
+        protonError(err, "pn_messenger_send", messenger);
+    }
+    else
+    {
+        err = 0;
+    }
+    if (sendError != NULL)
+    {
+        *sendError = err;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        pn_status_t status = pn_messenger_status(messenger, trackers[i]);
+        if (statuses != NULL)
+        {
+            statuses[i] = status;
+        }
+        if (PN_STATUS_ACCEPTED != status)
+        {
+            failures++;
+        }
+    }
+
+    err = pn_messenger_settle(messenger, trackers[count - 1], PN_CUMULATIVE);
+    if (err != 0)
+    {
+        protonError(err, "pn_messenger_settle", messenger);
+    }
+    return failures;
+}
@@ -21,17 +21,31 @@
 
 #ifdef _WIN32
 #define SNPRINTF _snprintf
+#define FSEEK64 _fseeki64
 #else
 #define SNPRINTF snprintf
+#define FSEEK64 fseeko
 #endif
 
 #ifndef SERVICEBUS_DOMAIN
 #define SERVICEBUS_DOMAIN	"servicebus.windows.net"
 #endif
 
+/* Room for a formatted UUID plus the terminating NUL */
+#define UUID_STRING_SIZE	37
+
 extern void protonError(int err, char *step, pn_messenger_t *messenger);
 extern void generateUuid(pn_uuid_t *pGenerated);
 extern void outputUuid(pn_uuid_t *pUuid);
+extern void formatUuid(pn_uuid_t *pUuid, char *buffer);
+extern bool findProperty(pn_data_t *properties, const char *key);
 extern char *urlEncodeKey(const char *key);
+extern pn_timestamp_t currentTime(void);
+extern long long currentTimeMicros(void);
+extern long long currentMicros(void);
+extern void sleepMicros(long long micros);
+extern bool isFinalStatus(pn_status_t status);
+extern int flushTracked(pn_messenger_t *messenger, pn_tracker_t *trackers,
+                        int count, pn_status_t *statuses, int *sendError);
 
 #endif /* __COMMON_H */
@@ -0,0 +1,346 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proton/message.h"
+#include "proton/messenger.h"
+#include "proton/error.h"
+#ifndef PN_VERSION_MAJOR
+#include "proton/version.h"
+#endif
+#if (PN_VERSION_MINOR > 7)
+#include "proton/engine.h"
+#endif
+
+#include "common.h"
+#include "fairrecv.h"
+
+/* Give up after this long with no messages on any link, like receiver.c */
+#define FAIR_IDLE_TIMEOUT	10000
+
+
+/*
+** Reads "path [weight]" lines from fileName into links[count...], skipping
+** blank lines and lines starting with '#'. Returns the new link count, or
+** -1 if the file cannot be read.
+*/
+int fairLoadEntities(const char *fileName, fairLink *links, int count,
+                     int maxLinks)
+{
+    char line[512];
+    FILE *file = fopen(fileName, "r");
+    if (NULL == file)
+    {
+        printf("ERROR: cannot open entity list %s\n", fileName);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char path[256];
+        int weight = 1;
+        int fields = sscanf(line, "%255s %d", path, &weight);
+        if ((fields < 1) || ('#' == path[0]))
+        {
+            continue;
+        }
+        if (count == maxLinks)
+        {
+            printf("Too many entities, ignoring everything after %d\n",
+                maxLinks);
+            break;
+        }
+        if ((weight < 1) || (weight > FAIR_MAX_WEIGHT))
+        {
+            printf("Weight %d for %s out of range, using 1\n", weight, path);
+            weight = 1;
+        }
+        memset(&links[count], 0, sizeof(fairLink));
+        strcpy(links[count].path, path);
+        links[count].weight = weight;
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+
+/*
+** Service Bus stamps each message with the time it was enqueued, in the
+** x-opt-enqueued-time message annotation. Returns 0 if it is not there.
+*/
+static pn_timestamp_t enqueuedTime(pn_message_t *message)
+{
+    pn_data_t *annotations = pn_message_annotations(message);
+    pn_timestamp_t enqueued = 0;
+
+    if (findProperty(annotations, "x-opt-enqueued-time") &&
+        (PN_TIMESTAMP == pn_data_type(annotations)))
+    {
+        enqueued = pn_data_get_timestamp(annotations);
+    }
+    pn_data_rewind(annotations);
+    return enqueued;
+}
+
+
+#if (PN_VERSION_MINOR > 7)
+/*
+** Tops every link back up to its weighted share of credit. Links are
+** looked up lazily because they only exist once the messenger has
+** attached them.
+*/
+static void fairFlow(pn_messenger_t *messenger, fairLink *links, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        if (NULL == links[i].link)
+        {
+            links[i].link = pn_messenger_get_link(messenger,
+                links[i].address, false);
+            if (NULL == links[i].link)
+            {
+                continue;
+            }
+        }
+        int target = links[i].weight * FAIR_CREDIT_QUANTUM;
+        int outstanding = pn_link_credit(links[i].link) +
+            pn_link_queued(links[i].link);
+        if (outstanding < target)
+        {
+            pn_link_flow(links[i].link, target - outstanding);
+        }
+    }
+}
+#endif
+
+
+static void fairStats(fairLink *links, int count, pn_timestamp_t elapsed)
+{
+    int i;
+    pn_timestamp_t now = currentTime();
+
+    printf("%-40s %6s %10s %10s %10s %10s %10s\n", "Entity", "Weight",
+        "Received", "Msg/s", "AvgLag ms", "MaxLag ms", "Idle ms");
+    for (i = 0; i < count; i++)
+    {
+        fairLink *l = &links[i];
+        printf("%-40s %6d %10lld %10.1f %10lld %10lld %10lld\n", l->path,
+            l->weight, l->received,
+            (elapsed > 0) ? (l->intervalReceived * 1000.0 / elapsed) : 0.0,
+            (l->intervalReceived > 0) ? (l->lagTotal / l->intervalReceived) : 0,
+            (long long)l->lagMax,
+            (l->lastReceived > 0) ? (long long)(now - l->lastReceived) : -1LL);
+        l->intervalReceived = 0;
+        l->lagTotal = 0;
+        l->lagMax = 0;
+    }
+}
+
+
+int fairReceive(char *sbnamespace, char *issuerName, char *issuerKey,
+                fairLink *links, int count)
+{
+    int i;
+    int totalWeight = 0;
+    for (i = 0; i < count; i++)
+    {
+        totalWeight += links[i].weight;
+    }
+    int credit = totalWeight * FAIR_CREDIT_QUANTUM;
+
+    pn_message_t *message = pn_message();
+
+    /*
+    ** A single messenger caches one connection per namespace and
+    ** credentials, so every subscription below shares it.
+    */
+    printf("CALL pn_messenger... ");
+    pn_messenger_t *messenger = pn_messenger(NULL);
+    printf("RETURNED\n");
+
+    printf("CALL pn_messenger_set_timeout... ");
+    /* Short, so that statistics are printed even when all links are idle */
+    int err = pn_messenger_set_timeout(messenger, 1000);
+    printf("RETURNED %d\n", err);
+    protonError(err, "pn_messenger_set_timeout", messenger);
+    if (err != 0)
+    {
+        return -1;
+    }
+
+#if (PN_VERSION_MINOR == 4)
+    printf("CALL pn_messenger_set_accept_mode... ");
+    err = pn_messenger_set_accept_mode(messenger, PN_ACCEPT_MODE_MANUAL);
+    printf("RETURNED %d\n", err);
+    protonError(err, "pn_messenger_set_accept_mode", messenger);
+    if (err != 0)
+    {
+        return -1;
+    }
+#endif
+
+#if (PN_VERSION_MINOR > 7)
+    /* PeekLock, see receiver.c */
+    printf("CALL pn_messenger_set_snd_settle_mode...");
+    err = pn_messenger_set_snd_settle_mode(messenger, PN_SND_UNSETTLED);
+    printf("RETURNED %d\n", err);
+    protonError(err, "pn_messenger_set_snd_settle_mode", messenger);
+    if (err != 0)
+    {
+        return -1;
+    }
+
+    printf("CALL pn_messenger_set_rcv_settle_mode...");
+    err = pn_messenger_set_rcv_settle_mode(messenger, PN_RCV_SECOND);
+    printf("RETURNED %d\n", err);
+    protonError(err, "pn_messenger_set_rcv_settle_mode", messenger);
+    if (err != 0)
+    {
+        return -1;
+    }
+#endif
+
+#if (PN_VERSION_MINOR > 4)
+    /*
+    ** Every message that can be outstanding across all links must fit
+    ** in the incoming window, or it is auto-accepted when it falls out.
+    */
+    printf("CALL pn_messenger_set_incoming_window... ");
+    err = pn_messenger_set_incoming_window(messenger, credit);
+    printf("RETURNED %d\n", err);
+    protonError(err, "pn_messenger_set_incoming_window", messenger);
+    if (err != 0)
+    {
+        return -1;
+    }
+#endif
+
+    for (i = 0; i < count; i++)
+    {
+        SNPRINTF(links[i].address, sizeof(links[i].address),
+            "amqps://%s:%s@%s." SERVICEBUS_DOMAIN "/%s",
+            issuerName, issuerKey, sbnamespace, links[i].path);
+        links[i].subscription =
+            pn_messenger_subscribe(messenger, links[i].address);
+        if (NULL == links[i].subscription)
+        {
+            printf("pn_messenger_subscribe returned NULL for %s\n",
+                links[i].path);
+            protonError(PN_ERR, "pn_messenger_subscribe", messenger);
+            return -1;
+        }
+    }
+    printf("Subscribed to %d entities, total weight %d\n", count,
+        totalWeight);
+
+    printf("CALL pn_messenger_start... ");
+    err = pn_messenger_start(messenger);
+    printf("RETURNED %d\n", err);
+    protonError(err, "pn_messenger_start", messenger);
+    if (err != 0)
+    {
+        return -1;
+    }
+
+    pn_timestamp_t lastMessage = currentTime();
+    pn_timestamp_t lastStats = lastMessage;
+    while (true)
+    {
+#if (PN_VERSION_MINOR > 7)
+        /*
+        ** Credit is issued per link in proportion to its weight, so the
+        ** broker itself interleaves deliveries fairly. Messenger's own
+        ** credit distribution is left idle by never calling _recv().
+        */
+        fairFlow(messenger, links, count);
+        err = pn_messenger_work(messenger, 1000);
+#else
+        /*
+        ** Older versions cannot reach the links, so fall back to letting
+        ** the messenger split credit evenly across all subscriptions.
+        ** That is still fair, it just ignores the weights.
+        */
+        err = pn_messenger_recv(messenger, credit);
+#endif
+        if ((err < 0) && (err != PN_TIMEOUT))
+        {
+            protonError(err, "pn_messenger_work", messenger);
+            printf("Breaking out of the receive loop\n");
+            break;
+        }
+
+        pn_timestamp_t now = currentTime();
+        while (pn_messenger_incoming(messenger))
+        {
+            err = pn_messenger_get(messenger, message);
+            protonError(err, "pn_messenger_get", messenger);
+            pn_tracker_t tracker = pn_messenger_incoming_tracker(messenger);
+
+            pn_subscription_t *subscription =
+                pn_messenger_incoming_subscription(messenger);
+            for (i = 0; i < count; i++)
+            {
+                if (links[i].subscription == subscription)
+                {
+                    fairLink *l = &links[i];
+                    pn_timestamp_t enqueued = enqueuedTime(message);
+                    l->received++;
+                    l->intervalReceived++;
+                    l->lastReceived = now;
+                    if ((enqueued > 0) && (now > enqueued))
+                    {
+                        l->lagTotal += now - enqueued;
+                        if (now - enqueued > l->lagMax)
+                        {
+                            l->lagMax = now - enqueued;
+                        }
+                    }
+                    break;
+                }
+            }
+
+            err = pn_messenger_accept(messenger, tracker, 0);
+            protonError(err, "pn_messenger_accept", messenger);
+            lastMessage = now;
+        }
+
+        if (now - lastStats >= FAIR_STATS_INTERVAL)
+        {
+            fairStats(links, count, now - lastStats);
+            lastStats = now;
+        }
+        if (now - lastMessage >= FAIR_IDLE_TIMEOUT)
+        {
+            printf("Timeout, breaking out of the receive loop\n");
+            break;
+        }
+    }
+
+    fairStats(links, count, currentTime() - lastStats);
+
+    printf("CALL pn_messenger_stop... ");
+    pn_messenger_stop(messenger);
+    printf("RETURNED\n");
+    pn_messenger_free(messenger);
+
+    pn_message_free(message);
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __FAIRRECV_H
+#define __FAIRRECV_H
+
+#include "proton/messenger.h"
+
+/*
+** Credit granted per unit of weight each scheduling round. A link with
+** weight 4 may have up to 4 * FAIR_CREDIT_QUANTUM messages outstanding,
+** so a busy link can never use up the credit of a quiet one.
+*/
+#define FAIR_CREDIT_QUANTUM	10
+#define FAIR_MAX_WEIGHT		100
+#define FAIR_MAX_LINKS		1024
+
+/* How often the per-link statistics are printed, in milliseconds */
+#define FAIR_STATS_INTERVAL	10000
+
+typedef struct fairLink
+{
+    char path[256];
+    char address[500];
+    int weight;
+    pn_subscription_t *subscription;
+    pn_link_t *link;
+    long long received;
+    long long intervalReceived;
+    long long lagTotal;     /* milliseconds, summed over the interval */
+    pn_timestamp_t lagMax;
+    pn_timestamp_t lastReceived;
+} fairLink;
+
+extern int fairLoadEntities(const char *fileName, fairLink *links, int count,
+                            int maxLinks);
+extern int fairReceive(char *sbnamespace, char *issuerName, char *issuerKey,
+                       fairLink *links, int count);
+
+#endif /* __FAIRRECV_H */
@@ -0,0 +1,901 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proton/message.h"
+
+#include "filter.h"
+
+enum
+{
+    OP_SLOT,      /* operand: slot index */
+    OP_CONST,     /* operand: constant index */
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_LIKE,
+    OP_ISNULL,
+    OP_NOT,
+    OP_AND,
+    OP_OR
+};
+
+/* The message headers that can be named as sys.<name> */
+enum
+{
+    HEADER_NONE,
+    HEADER_SUBJECT,
+    HEADER_CONTENT_TYPE,
+    HEADER_GROUP_ID,
+    HEADER_REPLY_TO,
+    HEADER_TO,
+    HEADER_TTL,
+    HEADER_PRIORITY
+};
+
+static const struct
+{
+    const char *name;
+    int header;
+} headerNames[] =
+{
+    /* AMQP names, then the Service Bus names for the same fields */
+    { "sys.subject", HEADER_SUBJECT },
+    { "sys.content_type", HEADER_CONTENT_TYPE },
+    { "sys.group_id", HEADER_GROUP_ID },
+    { "sys.reply_to", HEADER_REPLY_TO },
+    { "sys.to", HEADER_TO },
+    { "sys.ttl", HEADER_TTL },
+    { "sys.priority", HEADER_PRIORITY },
+    { "sys.Label", HEADER_SUBJECT },
+    { "sys.ContentType", HEADER_CONTENT_TYPE },
+    { "sys.SessionId", HEADER_GROUP_ID },
+    { "sys.ReplyTo", HEADER_REPLY_TO },
+    { "sys.To", HEADER_TO },
+    { NULL, HEADER_NONE }
+};
+
+typedef enum
+{
+    TOKEN_END,
+    TOKEN_IDENT,
+    TOKEN_STRING,
+    TOKEN_NUMBER,
+    TOKEN_OP,       /* comparison operator, text in token */
+    TOKEN_LPAREN,
+    TOKEN_RPAREN,
+    TOKEN_AND,
+    TOKEN_OR,
+    TOKEN_NOT,
+    TOKEN_IS,
+    TOKEN_NULL,
+    TOKEN_LIKE,
+    TOKEN_TRUE,
+    TOKEN_FALSE,
+    TOKEN_EXISTS,
+    TOKEN_ERROR
+} tokenType;
+
+typedef struct parser
+{
+    const char *input;
+    const char *position;
+    tokenType token;
+    char text[FILTER_MAX_NAME * 4];
+    double number;
+    filter *f;
+    bool failed;
+} parser;
+
+
+static void parseError(parser *p, const char *message)
+{
+    if (!p->failed)
+    {
+        printf("Filter error at offset %d: %s\n",
+            (int)(p->position - p->input), message);
+        p->failed = true;
+    }
+}
+
+
+static bool keyword(const char *start, size_t length, const char *word)
+{
+    size_t i;
+    if (strlen(word) != length)
+    {
+        return false;
+    }
+    for (i = 0; i < length; i++)
+    {
+        if (toupper((unsigned char)start[i]) != word[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static void nextToken(parser *p)
+{
+    const char *s = p->position;
+
+    while (isspace((unsigned char)*s))
+    {
+        s++;
+    }
+    p->position = s;
+    p->text[0] = '\0';
+
+    if ('\0' == *s)
+    {
+        p->token = TOKEN_END;
+    }
+    else if ('(' == *s || ')' == *s)
+    {
+        p->token = ('(' == *s) ? TOKEN_LPAREN : TOKEN_RPAREN;
+        p->position = s + 1;
+    }
+    else if (strchr("=<>!", *s) != NULL)
+    {
+        size_t length = 1;
+        if (('<' == s[0] && ('=' == s[1] || '>' == s[1])) ||
+            ('>' == s[0] && '=' == s[1]) || ('!' == s[0] && '=' == s[1]))
+        {
+            length = 2;
+        }
+        else if ('!' == s[0])
+        {
+            p->token = TOKEN_ERROR;
+            return;
+        }
+        memcpy(p->text, s, length);
+        p->text[length] = '\0';
+        p->token = TOKEN_OP;
+        p->position = s + length;
+    }
+    else if ('\'' == *s)
+    {
+        /* 'it''s' is the string it's */
+        size_t length = 0;
+        s++;
+        for (;;)
+        {
+            if ('\0' == *s)
+            {
+                p->token = TOKEN_ERROR;
+                return;
+            }
+            if ('\'' == *s)
+            {
+                if (s[1] != '\'')
+                {
+                    break;
+                }
+                s++;
+            }
+            if (length + 1 >= sizeof(p->text))
+            {
+                p->token = TOKEN_ERROR;
+                return;
+            }
+            p->text[length++] = *s++;
+        }
+        p->text[length] = '\0';
+        p->token = TOKEN_STRING;
+        p->position = s + 1;
+    }
+    else if (isdigit((unsigned char)*s) || ('-' == *s) || ('.' == *s))
+    {
+        char *end;
+        p->number = strtod(s, &end);
+        if (end == s)
+        {
+            p->token = TOKEN_ERROR;
+            return;
+        }
+        p->token = TOKEN_NUMBER;
+        p->position = end;
+    }
+    else if (isalpha((unsigned char)*s) || ('_' == *s))
+    {
+        const char *start = s;
+        size_t length;
+        while (isalnum((unsigned char)*s) || ('_' == *s) || ('.' == *s) ||
+            ('-' == *s))
+        {
+            s++;
+        }
+        length = (size_t)(s - start);
+        p->position = s;
+        if (keyword(start, length, "AND")) p->token = TOKEN_AND;
+        else if (keyword(start, length, "OR")) p->token = TOKEN_OR;
+        else if (keyword(start, length, "NOT")) p->token = TOKEN_NOT;
+        else if (keyword(start, length, "IS")) p->token = TOKEN_IS;
+        else if (keyword(start, length, "NULL")) p->token = TOKEN_NULL;
+        else if (keyword(start, length, "LIKE")) p->token = TOKEN_LIKE;
+        else if (keyword(start, length, "TRUE")) p->token = TOKEN_TRUE;
+        else if (keyword(start, length, "FALSE")) p->token = TOKEN_FALSE;
+        else if (keyword(start, length, "EXISTS")) p->token = TOKEN_EXISTS;
+        else if (length >= FILTER_MAX_NAME) p->token = TOKEN_ERROR;
+        else
+        {
+            memcpy(p->text, start, length);
+            p->text[length] = '\0';
+            p->token = TOKEN_IDENT;
+        }
+    }
+    else
+    {
+        p->token = TOKEN_ERROR;
+    }
+}
+
+
+static void emit(parser *p, int op, int operand, int stackEffect)
+{
+    filter *f = p->f;
+    if (f->codeSize + 2 > FILTER_MAX_CODE)
+    {
+        parseError(p, "expression too long");
+        return;
+    }
+    f->code[f->codeSize++] = (unsigned char)op;
+    if (operand >= 0)
+    {
+        f->code[f->codeSize++] = (unsigned char)operand;
+    }
+    f->depth += stackEffect;
+    if (f->depth > f->maxDepth)
+    {
+        f->maxDepth = f->depth;
+    }
+    if (f->maxDepth > FILTER_MAX_STACK)
+    {
+        parseError(p, "expression nested too deeply");
+    }
+}
+
+
+static void emitSlot(parser *p, const char *name)
+{
+    filter *f = p->f;
+    int header = HEADER_NONE;
+    int i;
+
+    for (i = 0; headerNames[i].name != NULL; i++)
+    {
+        if (0 == strcmp(headerNames[i].name, name))
+        {
+            header = headerNames[i].header;
+            break;
+        }
+    }
+    if ((HEADER_NONE == header) && (0 == strncmp(name, "sys.", 4)))
+    {
+        parseError(p, "unknown sys. header");
+        return;
+    }
+
+    for (i = 0; i < f->slotCount; i++)
+    {
+        if (0 == strcmp(f->slotNames[i], name))
+        {
+            emit(p, OP_SLOT, i, 1);
+            return;
+        }
+    }
+    if (FILTER_MAX_SLOTS == f->slotCount)
+    {
+        parseError(p, "too many names");
+        return;
+    }
+    strcpy(f->slotNames[i], name);
+    f->slotLengths[i] = strlen(name);
+    f->slotHeaders[i] = header;
+    if (HEADER_NONE == header)
+    {
+        f->propertySlots++;
+    }
+    f->slotCount++;
+    emit(p, OP_SLOT, i, 1);
+}
+
+
+static void emitConstant(parser *p, filterValue *value)
+{
+    filter *f = p->f;
+    if (FILTER_MAX_CONSTANTS == f->constantCount)
+    {
+        parseError(p, "too many constants");
+        return;
+    }
+    f->constants[f->constantCount] = *value;
+    emit(p, OP_CONST, f->constantCount++, 1);
+}
+
+
+static void parseOr(parser *p);
+
+
+static void parseOperand(parser *p)
+{
+    filterValue value;
+    memset(&value, 0, sizeof(value));
+
+    switch (p->token)
+    {
+    case TOKEN_IDENT:
+        emitSlot(p, p->text);
+        break;
+
+    case TOKEN_STRING:
+        value.type = FILTER_STRING;
+        value.length = strlen(p->text);
+        value.string = (char *)malloc(value.length + 1);
+        if (NULL == value.string)
+        {
+            parseError(p, "out of memory");
+            return;
+        }
+        memcpy((char *)value.string, p->text, value.length + 1);
+        emitConstant(p, &value);
+        break;
+
+    case TOKEN_NUMBER:
+        value.type = FILTER_NUMBER;
+        value.number = p->number;
+        emitConstant(p, &value);
+        break;
+
+    case TOKEN_TRUE:
+    case TOKEN_FALSE:
+        value.type = FILTER_BOOL;
+        value.boolean = (TOKEN_TRUE == p->token);
+        emitConstant(p, &value);
+        break;
+
+    case TOKEN_LPAREN:
+        nextToken(p);
+        parseOr(p);
+        if (p->token != TOKEN_RPAREN)
+        {
+            parseError(p, "expected )");
+        }
+        break;
+
+    case TOKEN_EXISTS:
+        nextToken(p);
+        if (p->token != TOKEN_LPAREN)
+        {
+            parseError(p, "expected ( after EXISTS");
+            return;
+        }
+        nextToken(p);
+        if (p->token != TOKEN_IDENT)
+        {
+            parseError(p, "expected a name in EXISTS");
+            return;
+        }
+        emitSlot(p, p->text);
+        emit(p, OP_ISNULL, -1, 0);
+        emit(p, OP_NOT, -1, 0);
+        nextToken(p);
+        if (p->token != TOKEN_RPAREN)
+        {
+            parseError(p, "expected )");
+        }
+        break;
+
+    default:
+        parseError(p, "expected a name or a value");
+        return;
+    }
+    nextToken(p);
+}
+
+
+static void parsePredicate(parser *p)
+{
+    parseOperand(p);
+    if (p->failed)
+    {
+        return;
+    }
+
+    if (TOKEN_OP == p->token)
+    {
+        int op = OP_EQ;
+        if (0 == strcmp(p->text, "=")) op = OP_EQ;
+        else if (0 == strcmp(p->text, "<>")) op = OP_NE;
+        else if (0 == strcmp(p->text, "!=")) op = OP_NE;
+        else if (0 == strcmp(p->text, "<")) op = OP_LT;
+        else if (0 == strcmp(p->text, "<=")) op = OP_LE;
+        else if (0 == strcmp(p->text, ">")) op = OP_GT;
+        else if (0 == strcmp(p->text, ">=")) op = OP_GE;
+        nextToken(p);
+        parseOperand(p);
+        emit(p, op, -1, -1);
+    }
+    else if (TOKEN_IS == p->token)
+    {
+        bool negate = false;
+        nextToken(p);
+        if (TOKEN_NOT == p->token)
+        {
+            negate = true;
+            nextToken(p);
+        }
+        if (p->token != TOKEN_NULL)
+        {
+            parseError(p, "expected NULL after IS");
+            return;
+        }
+        nextToken(p);
+        emit(p, OP_ISNULL, -1, 0);
+        if (negate)
+        {
+            emit(p, OP_NOT, -1, 0);
+        }
+    }
+    else if ((TOKEN_LIKE == p->token) || (TOKEN_NOT == p->token))
+    {
+        bool negate = (TOKEN_NOT == p->token);
+        if (negate)
+        {
+            nextToken(p);
+            if (p->token != TOKEN_LIKE)
+            {
+                parseError(p, "expected LIKE after NOT");
+                return;
+            }
+        }
+        nextToken(p);
+        if (p->token != TOKEN_STRING)
+        {
+            parseError(p, "LIKE needs a 'pattern'");
+            return;
+        }
+        parseOperand(p);
+        emit(p, OP_LIKE, -1, -1);
+        if (negate)
+        {
+            emit(p, OP_NOT, -1, 0);
+        }
+    }
+}
+
+
+static void parseNot(parser *p)
+{
+    if (TOKEN_NOT == p->token)
+    {
+        nextToken(p);
+        parseNot(p);
+        emit(p, OP_NOT, -1, 0);
+    }
+    else
+    {
+        parsePredicate(p);
+    }
+}
+
+
+static void parseAnd(parser *p)
+{
+    parseNot(p);
+    while (!p->failed && (TOKEN_AND == p->token))
+    {
+        nextToken(p);
+        parseNot(p);
+        emit(p, OP_AND, -1, -1);
+    }
+}
+
+
+static void parseOr(parser *p)
+{
+    parseAnd(p);
+    while (!p->failed && (TOKEN_OR == p->token))
+    {
+        nextToken(p);
+        parseAnd(p);
+        emit(p, OP_OR, -1, -1);
+    }
+}
+
+
+filter *filterCompile(const char *expression)
+{
+    parser p;
+    filter *f = (filter *)calloc(1, sizeof(filter));
+    if (NULL == f)
+    {
+        return NULL;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.input = expression;
+    p.position = expression;
+    p.f = f;
+    nextToken(&p);
+    parseOr(&p);
+    if (!p.failed && (p.token != TOKEN_END))
+    {
+        parseError(&p, (TOKEN_ERROR == p.token) ? "unrecognized input" :
+            "unexpected input after the expression");
+    }
+    if (p.failed)
+    {
+        filterFree(f);
+        return NULL;
+    }
+    printf("Compiled filter to %d bytes of code, %d names, stack depth %d\n",
+        f->codeSize, f->slotCount, f->maxDepth);
+    return f;
+}
+
+
+void filterFree(filter *f)
+{
+    int i;
+    if (NULL == f)
+    {
+        return;
+    }
+    for (i = 0; i < f->constantCount; i++)
+    {
+        if (FILTER_STRING == f->constants[i].type)
+        {
+            free((char *)f->constants[i].string);
+        }
+    }
+    free(f);
+}
+
+
+/*
+** Converts the value under the cursor. Anything that is not a string,
+** number or boolean becomes NULL, so comparisons with it never match.
+*/
+static void loadValue(pn_data_t *data, filterValue *value)
+{
+    memset(value, 0, sizeof(filterValue));
+    switch (pn_data_type(data))
+    {
+    case PN_BOOL:
+        value->type = FILTER_BOOL;
+        value->boolean = pn_data_get_bool(data);
+        break;
+    case PN_UBYTE: value->type = FILTER_NUMBER;
+        value->number = pn_data_get_ubyte(data); break;
+    case PN_BYTE: value->type = FILTER_NUMBER;
+        value->number = pn_data_get_byte(data); break;
+    case PN_USHORT: value->type = FILTER_NUMBER;
+        value->number = pn_data_get_ushort(data); break;
+    case PN_SHORT: value->type = FILTER_NUMBER;
+        value->number = pn_data_get_short(data); break;
+    case PN_UINT: value->type = FILTER_NUMBER;
+        value->number = pn_data_get_uint(data); break;
+    case PN_INT: value->type = FILTER_NUMBER;
+        value->number = pn_data_get_int(data); break;
+    case PN_ULONG: value->type = FILTER_NUMBER;
+        value->number = (double)pn_data_get_ulong(data); break;
+    case PN_LONG: value->type = FILTER_NUMBER;
+        value->number = (double)pn_data_get_long(data); break;
+    case PN_TIMESTAMP: value->type = FILTER_NUMBER;
+        value->number = (double)pn_data_get_timestamp(data); break;
+    case PN_FLOAT: value->type = FILTER_NUMBER;
+        value->number = pn_data_get_float(data); break;
+    case PN_DOUBLE: value->type = FILTER_NUMBER;
+        value->number = pn_data_get_double(data); break;
+    case PN_STRING:
+    case PN_SYMBOL:
+        {
+            pn_bytes_t bytes = pn_data_get_bytes(data);
+            value->type = FILTER_STRING;
+            value->string = bytes.start;
+            value->length = bytes.size;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+
+static void loadString(filterValue *value, const char *string)
+{
+    if (string != NULL)
+    {
+        value->type = FILTER_STRING;
+        value->string = string;
+        value->length = strlen(string);
+    }
+}
+
+
+static void loadSlots(filter *f, pn_message_t *message)
+{
+    int i;
+    int found = 0;
+
+    for (i = 0; i < f->slotCount; i++)
+    {
+        filterValue *value = &f->slots[i];
+        memset(value, 0, sizeof(filterValue));
+        switch (f->slotHeaders[i])
+        {
+        case HEADER_SUBJECT:
+            loadString(value, pn_message_get_subject(message));
+            break;
+        case HEADER_CONTENT_TYPE:
+            loadString(value, pn_message_get_content_type(message));
+            break;
+        case HEADER_GROUP_ID:
+            loadString(value, pn_message_get_group_id(message));
+            break;
+        case HEADER_REPLY_TO:
+            loadString(value, pn_message_get_reply_to(message));
+            break;
+        case HEADER_TO:
+            loadString(value, pn_message_get_address(message));
+            break;
+        case HEADER_TTL:
+            value->type = FILTER_NUMBER;
+            value->number = pn_message_get_ttl(message);
+            break;
+        case HEADER_PRIORITY:
+            value->type = FILTER_NUMBER;
+            value->number = pn_message_get_priority(message);
+            break;
+        default:
+            break;
+        }
+    }
+    if (0 == f->propertySlots)
+    {
+        return;
+    }
+
+    /* One pass over the map, stopping once every name has been seen */
+    pn_data_t *properties = pn_message_properties(message);
+    pn_data_rewind(properties);
+    if (!pn_data_next(properties) || (pn_data_type(properties) != PN_MAP))
+    {
+        return;
+    }
+    pn_data_enter(properties);
+    while ((found < f->propertySlots) && pn_data_next(properties))
+    {
+        int slot = -1;
+        if ((PN_STRING == pn_data_type(properties)) ||
+            (PN_SYMBOL == pn_data_type(properties)))
+        {
+            pn_bytes_t key = pn_data_get_bytes(properties);
+            for (i = 0; i < f->slotCount; i++)
+            {
+                if ((HEADER_NONE == f->slotHeaders[i]) &&
+                    (f->slotLengths[i] == key.size) &&
+                    (0 == memcmp(f->slotNames[i], key.start, key.size)))
+                {
+                    slot = i;
+                    break;
+                }
+            }
+        }
+        if (!pn_data_next(properties))
+        {
+            break;
+        }
+        if ((slot >= 0) && (FILTER_NULL == f->slots[slot].type))
+        {
+            loadValue(properties, &f->slots[slot]);
+            found++;
+        }
+    }
+    pn_data_rewind(properties);
+}
+
+
+/*
+** Matches s against a LIKE pattern. Only the most recent '%' is ever
+** retried, each time taking one more character: whatever an earlier '%'
+** could take instead, the later one can take as well. That keeps the
+** match linear in practice and at worst s times p.
+*/
+static bool like(const char *s, size_t sLength, const char *p, size_t pLength)
+{
+    size_t si = 0;
+    size_t pi = 0;
+    bool starred = false;
+    size_t star = 0;          /* pattern index just after the last '%' */
+    size_t mark = 0;          /* where that '%' began taking characters */
+
+    while (si < sLength)
+    {
+        if ((pi < pLength) && ('%' == p[pi]))
+        {
+            starred = true;
+            star = ++pi;
+            mark = si;
+        }
+        else if ((pi < pLength) && (('_' == p[pi]) || (p[pi] == s[si])))
+        {
+            pi++;
+            si++;
+        }
+        else if (starred)
+        {
+            pi = star;
+            si = ++mark;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while ((pi < pLength) && ('%' == p[pi]))
+    {
+        pi++;
+    }
+    return (pi == pLength);
+}
+
+
+/*
+** Compares two values, giving -1, 0 or 1 in *order. Returns false if the
+** values cannot be compared, which makes the comparison NULL.
+*/
+static bool compare(filterValue *a, filterValue *b, int *order)
+{
+    if ((a->type != b->type) || (FILTER_NULL == a->type))
+    {
+        return false;
+    }
+    if (FILTER_NUMBER == a->type)
+    {
+        *order = (a->number < b->number) ? -1 : (a->number > b->number);
+    }
+    else if (FILTER_STRING == a->type)
+    {
+        size_t n = (a->length < b->length) ? a->length : b->length;
+        int c = memcmp(a->string, b->string, n);
+        *order = (c != 0) ? c : ((a->length < b->length) ? -1 :
+            (a->length > b->length));
+    }
+    else
+    {
+        *order = (int)a->boolean - (int)b->boolean;
+    }
+    return true;
+}
+
+
+bool filterMatch(filter *f, pn_message_t *message)
+{
+    filterValue stack[FILTER_MAX_STACK];
+    int top = -1;
+    int pc = 0;
+
+    loadSlots(f, message);
+
+    while (pc < f->codeSize)
+    {
+        int op = f->code[pc++];
+        filterValue *a;
+        filterValue *b;
+        int order;
+
+        switch (op)
+        {
+        case OP_SLOT:
+            stack[++top] = f->slots[f->code[pc++]];
+            break;
+
+        case OP_CONST:
+            stack[++top] = f->constants[f->code[pc++]];
+            break;
+
+        case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+            b = &stack[top--];
+            a = &stack[top];
+            if (!compare(a, b, &order) ||
+                ((FILTER_BOOL == a->type) && (op != OP_EQ) && (op != OP_NE)))
+            {
+                a->type = FILTER_NULL;
+                break;
+            }
+            a->type = FILTER_BOOL;
+            switch (op)
+            {
+            case OP_EQ: a->boolean = (0 == order); break;
+            case OP_NE: a->boolean = (0 != order); break;
+            case OP_LT: a->boolean = (order < 0); break;
+            case OP_LE: a->boolean = (order <= 0); break;
+            case OP_GT: a->boolean = (order > 0); break;
+            default:    a->boolean = (order >= 0); break;
+            }
+            break;
+
+        case OP_LIKE:
+            b = &stack[top--];
+            a = &stack[top];
+            if (FILTER_STRING != a->type)
+            {
+                a->type = FILTER_NULL;
+                break;
+            }
+            a->boolean = like(a->string, a->length, b->string, b->length);
+            a->type = FILTER_BOOL;
+            break;
+
+        case OP_ISNULL:
+            a = &stack[top];
+            a->boolean = (FILTER_NULL == a->type);
+            a->type = FILTER_BOOL;
+            break;
+
+        case OP_NOT:
+            a = &stack[top];
+            if (FILTER_BOOL == a->type)
+            {
+                a->boolean = !a->boolean;
+            }
+            else
+            {
+                a->type = FILTER_NULL;
+            }
+            break;
+
+        case OP_AND:
+        case OP_OR:
+            b = &stack[top--];
+            a = &stack[top];
+            {
+                /* SQL three-valued logic; non-booleans count as NULL */
+                bool aKnown = (FILTER_BOOL == a->type);
+                bool bKnown = (FILTER_BOOL == b->type);
+                bool decisive = (OP_OR == op);
+                if ((aKnown && (a->boolean == decisive)) ||
+                    (bKnown && (b->boolean == decisive)))
+                {
+                    a->type = FILTER_BOOL;
+                    a->boolean = decisive;
+                }
+                else if (aKnown && bKnown)
+                {
+                    a->type = FILTER_BOOL;
+                    a->boolean = !decisive;
+                }
+                else
+                {
+                    a->type = FILTER_NULL;
+                }
+            }
+            break;
+        }
+    }
+
+    return (0 == top) && (FILTER_BOOL == stack[0].type) && stack[0].boolean;
+}
@@ -0,0 +1,81 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __FILTER_H
+#define __FILTER_H
+
+#include "proton/message.h"
+
+/*
+** Client-side message filters, written in a subset of the Service Bus
+** SQL filter syntax:
+**
+**   MessageType = 'TextMessage' AND (TestInt > 0 OR sys.Label LIKE 'Test%')
+**
+** Operands are application property names, sys.* header names (see
+** filter.c), 'strings', numbers, TRUE and FALSE. Operators are = <> !=
+** < <= > >= [NOT] LIKE, IS [NOT] NULL, EXISTS(name), NOT, AND, OR and
+** parentheses. A missing property is NULL, and as in SQL a comparison
+** involving NULL is neither true nor false, so the message does not match.
+**
+** An expression is compiled once into stack-machine bytecode. Matching
+** makes a single pass over the properties map, picking out only the
+** properties the expression names, and never looks at the body.
+*/
+#define FILTER_MAX_CODE		256
+#define FILTER_MAX_SLOTS	16
+#define FILTER_MAX_CONSTANTS	32
+#define FILTER_MAX_STACK	32
+#define FILTER_MAX_NAME		64
+
+typedef enum
+{
+    FILTER_NULL,
+    FILTER_BOOL,
+    FILTER_NUMBER,
+    FILTER_STRING
+} filterType;
+
+typedef struct filterValue
+{
+    filterType type;
+    bool boolean;
+    double number;
+    const char *string;
+    size_t length;
+} filterValue;
+
+typedef struct filter
+{
+    unsigned char code[FILTER_MAX_CODE];
+    int codeSize;
+    int depth;
+    int maxDepth;
+    char slotNames[FILTER_MAX_SLOTS][FILTER_MAX_NAME];
+    size_t slotLengths[FILTER_MAX_SLOTS];
+    int slotHeaders[FILTER_MAX_SLOTS];  /* 0 for a property, else header */
+    int slotCount;
+    int propertySlots;
+    filterValue constants[FILTER_MAX_CONSTANTS];
+    int constantCount;
+    filterValue slots[FILTER_MAX_SLOTS]; /* loaded per message */
+} filter;
+
+extern filter *filterCompile(const char *expression);
+extern bool filterMatch(filter *f, pn_message_t *message);
+extern void filterFree(filter *f);
+
+#endif /* __FILTER_H */
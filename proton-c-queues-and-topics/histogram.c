@@ -0,0 +1,151 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "histogram.h"
+
+
+static int bucketOf(long long value)
+{
+    int msb = 0;
+    int shift;
+
+    if (value < 2 * HISTOGRAM_SUB_BUCKETS)
+    {
+        return (value < 0) ? 0 : (int)value;
+    }
+    while ((value >> (msb + 1)) != 0)
+    {
+        msb++;
+    }
+    shift = msb - 6;
+    if ((shift + 1) * HISTOGRAM_SUB_BUCKETS >= HISTOGRAM_BUCKETS)
+    {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    return ((shift + 1) * HISTOGRAM_SUB_BUCKETS) +
+        (int)((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+
+/* The largest value that falls in the given bucket */
+static long long bucketLimit(int bucket)
+{
+    int shift;
+
+    if (bucket < 2 * HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    shift = (bucket / HISTOGRAM_SUB_BUCKETS) - 1;
+    return ((((long long)(bucket % HISTOGRAM_SUB_BUCKETS) +
+        HISTOGRAM_SUB_BUCKETS + 1) << shift) - 1);
+}
+
+
+void histogramReset(histogram *h)
+{
+    memset(h, 0, sizeof(histogram));
+}
+
+
+void histogramRecord(histogram *h, long long value)
+{
+    if (value < 0)
+    {
+        value = 0;
+    }
+    h->counts[bucketOf(value)]++;
+    if ((0 == h->total) || (value < h->min))
+    {
+        h->min = value;
+    }
+    if (value > h->max)
+    {
+        h->max = value;
+    }
+    h->total++;
+    h->sum += (double)value;
+}
+
+
+void histogramMerge(histogram *into, histogram *from)
+{
+    int i;
+
+    if (0 == from->total)
+    {
+        return;
+    }
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        into->counts[i] += from->counts[i];
+    }
+    if ((0 == into->total) || (from->min < into->min))
+    {
+        into->min = from->min;
+    }
+    if (from->max > into->max)
+    {
+        into->max = from->max;
+    }
+    into->total += from->total;
+    into->sum += from->sum;
+}
+
+
+/*
+** Returns the value at the given percentile (0-100), reported as the top
+** of its bucket but never more than the largest value recorded.
+*/
+long long histogramPercentile(histogram *h, double percentile)
+{
+    long long rank;
+    long long seen = 0;
+    int i;
+
+    if (0 == h->total)
+    {
+        return 0;
+    }
+    rank = (long long)((percentile / 100.0) * h->total + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= rank)
+        {
+            long long limit = bucketLimit(i);
+            return (limit > h->max) ? h->max : limit;
+        }
+    }
+    return h->max;
+}
+
+
+void histogramPrint(histogram *h, const char *label)
+{
+    printf("%s count=%lld min=%lld avg=%.1f p50=%lld p90=%lld p99=%lld "
+        "p99.9=%lld max=%lld\n", label, h->total, h->min,
+        (h->total > 0) ? (h->sum / h->total) : 0.0,
+        histogramPercentile(h, 50.0), histogramPercentile(h, 90.0),
+        histogramPercentile(h, 99.0), histogramPercentile(h, 99.9), h->max);
+}
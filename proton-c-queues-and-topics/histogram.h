@@ -0,0 +1,44 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+/*
+** A fixed-size log-linear histogram. Values below 128 are counted
+** exactly; above that each power of two is split into 64 buckets, so
+** any recorded value is reported to within about 1.5%. Values up to
+** 2^40 fit, which is over 12 days in microseconds.
+*/
+#define HISTOGRAM_SUB_BUCKETS	64
+#define HISTOGRAM_BUCKETS	(36 * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct histogram
+{
+    long long counts[HISTOGRAM_BUCKETS];
+    long long total;
+    long long min;
+    long long max;
+    double sum;
+} histogram;
+
+extern void histogramReset(histogram *h);
+extern void histogramRecord(histogram *h, long long value);
+extern void histogramMerge(histogram *into, histogram *from);
+extern long long histogramPercentile(histogram *h, double percentile);
+extern void histogramPrint(histogram *h, const char *label);
+
+#endif /* __HISTOGRAM_H */
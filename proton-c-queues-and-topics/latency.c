@@ -0,0 +1,189 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proton/message.h"
+#include "proton/messenger.h"
+
+#include "common.h"
+#include "latency.h"
+
+
+/*
+** Adds the send timestamp to a properties map the caller has entered.
+*/
+void latencyStamp(pn_data_t *properties)
+{
+    pn_data_put_string(properties, pn_bytes(strlen(LATENCY_SEND_PROPERTY),
+        LATENCY_SEND_PROPERTY));
+    pn_data_put_long(properties, currentTimeMicros());
+}
+
+
+latencyTracker *latencyCreate(const char *csvFile)
+{
+    latencyTracker *tracker = (latencyTracker *)calloc(1,
+        sizeof(latencyTracker));
+    if (NULL == tracker)
+    {
+        return NULL;
+    }
+    tracker->start = currentMicros();
+    tracker->slotStart = tracker->start;
+    if ((csvFile != NULL) && (strcmp(csvFile, "-") != 0))
+    {
+        tracker->csv = fopen(csvFile, "a");
+        if (NULL == tracker->csv)
+        {
+            printf("ERROR: cannot open %s, not exporting latency\n", csvFile);
+        }
+        else if ((0 == fseek(tracker->csv, 0, SEEK_END)) &&
+            (0 == ftell(tracker->csv)))
+        {
+            /* Later runs append their rows under the first run's header */
+            fprintf(tracker->csv, "time_ms,window_s,msgs_per_s,"
+                "e2e_count,e2e_p50_us,e2e_p90_us,e2e_p99_us,e2e_p999_us,"
+                "e2e_max_us,broker_p50_us,broker_p99_us,broker_max_us\n");
+        }
+    }
+    return tracker;
+}
+
+
+void latencyRecord(latencyTracker *tracker, pn_message_t *message)
+{
+    long long now = currentTimeMicros();
+    pn_data_t *properties = pn_message_properties(message);
+    pn_data_t *annotations = pn_message_annotations(message);
+
+    latencyTick(tracker, false);
+    tracker->received++;
+    tracker->slotReceived[tracker->current]++;
+
+    if (findProperty(properties, LATENCY_SEND_PROPERTY) &&
+        (PN_LONG == pn_data_type(properties)))
+    {
+        histogramRecord(&tracker->endToEnd[tracker->current],
+            now - pn_data_get_long(properties));
+    }
+    pn_data_rewind(properties);
+
+    if (findProperty(annotations, "x-opt-enqueued-time") &&
+        (PN_TIMESTAMP == pn_data_type(annotations)))
+    {
+        histogramRecord(&tracker->broker[tracker->current],
+            now - (long long)pn_data_get_timestamp(annotations) * 1000);
+    }
+    pn_data_rewind(annotations);
+}
+
+
+static void latencyReport(latencyTracker *tracker, long long now)
+{
+    int i;
+    long long windowReceived = 0;
+    long long window = ((LATENCY_SLOTS - 1) * LATENCY_SLOT_MICROS) +
+        (now - tracker->slotStart);
+    if (window > now - tracker->start)
+    {
+        window = now - tracker->start; /* the window has not filled yet */
+    }
+    histogram *merged = &tracker->merged;
+
+    for (i = 0; i < LATENCY_SLOTS; i++)
+    {
+        windowReceived += tracker->slotReceived[i];
+    }
+    double rate = (window > 0) ? (windowReceived * 1000000.0 / window) : 0.0;
+
+    histogramReset(merged);
+    for (i = 0; i < LATENCY_SLOTS; i++)
+    {
+        histogramMerge(merged, &tracker->endToEnd[i]);
+    }
+    printf("LATENCY window=%.0fs rate=%.1f/s total=%lld\n",
+        window / 1000000.0, rate, tracker->received);
+    histogramPrint(merged, "  end-to-end us");
+    long long e2e[5];
+    e2e[0] = histogramPercentile(merged, 50.0);
+    e2e[1] = histogramPercentile(merged, 90.0);
+    e2e[2] = histogramPercentile(merged, 99.0);
+    e2e[3] = histogramPercentile(merged, 99.9);
+    e2e[4] = merged->max;
+    long long e2eCount = merged->total;
+
+    histogramReset(merged);
+    for (i = 0; i < LATENCY_SLOTS; i++)
+    {
+        histogramMerge(merged, &tracker->broker[i]);
+    }
+    histogramPrint(merged, "  broker us    ");
+
+    if (tracker->csv != NULL)
+    {
+        fprintf(tracker->csv, "%lld,%.0f,%.1f,%lld,%lld,%lld,%lld,%lld,%lld,"
+            "%lld,%lld,%lld\n", (long long)currentTime(), window / 1000000.0,
+            rate, e2eCount, e2e[0], e2e[1], e2e[2], e2e[3], e2e[4],
+            histogramPercentile(merged, 50.0),
+            histogramPercentile(merged, 99.0), merged->max);
+        fflush(tracker->csv);
+    }
+}
+
+
+/*
+** Moves the window along if the current slot is full, reporting once per
+** slot. Call it periodically even when no messages arrive.
+*/
+void latencyTick(latencyTracker *tracker, bool force)
+{
+    long long now = currentMicros();
+    bool rotated = false;
+
+    while (now - tracker->slotStart >= LATENCY_SLOT_MICROS)
+    {
+        if (!rotated)
+        {
+            latencyReport(tracker, now);
+            rotated = true;
+        }
+        tracker->current = (tracker->current + 1) % LATENCY_SLOTS;
+        histogramReset(&tracker->endToEnd[tracker->current]);
+        histogramReset(&tracker->broker[tracker->current]);
+        tracker->slotReceived[tracker->current] = 0;
+        tracker->slotStart += LATENCY_SLOT_MICROS;
+    }
+    if (force && !rotated)
+    {
+        latencyReport(tracker, now);
+    }
+}
+
+
+void latencyFree(latencyTracker *tracker)
+{
+    if (NULL == tracker)
+    {
+        return;
+    }
+    if (tracker->csv != NULL)
+    {
+        fclose(tracker->csv);
+    }
+    free(tracker);
+}
@@ -0,0 +1,70 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include <stdio.h>
+#include "proton/message.h"
+#include "histogram.h"
+
+/*
+** The sender stamps each message with its wall-clock send time in
+** microseconds, in the SendTimeMicros application property (and, at
+** millisecond resolution, in the creation-time header). The receiver
+** records two latencies per message, both in microseconds:
+**
+**   end-to-end  SendTimeMicros to receipt by this process
+**   broker      x-opt-enqueued-time (set by Service Bus) to receipt
+**
+** Both depend on the clocks of the machines involved being in sync.
+**
+** The stamp is taken when the sender builds the message. Most modes
+** build each message just before pn_messenger_put(), so that is its send
+** time; priority classes build a message when it leaves its class queue,
+** and the sender reports the time spent queued before that itself. With
+** -delay and -outbox, messages are built when they are produced and then
+** held or spooled, so end-to-end latency includes that time and any
+** outage spent in the outbox: it is the delay the producer sees.
+**
+** Percentiles are reported over a sliding window made of LATENCY_SLOTS
+** histograms, each covering LATENCY_SLOT_MICROS; the oldest one is
+** cleared and reused as the window moves on.
+*/
+#define LATENCY_SEND_PROPERTY	"SendTimeMicros"
+#define LATENCY_SLOTS		6
+#define LATENCY_SLOT_MICROS	10000000LL
+
+typedef struct latencyTracker
+{
+    histogram endToEnd[LATENCY_SLOTS];
+    histogram broker[LATENCY_SLOTS];
+    histogram merged;
+    int current;
+    long long start;              /* currentMicros() */
+    long long slotStart;
+    long long received;
+    long long slotReceived[LATENCY_SLOTS];
+    FILE *csv;
+} latencyTracker;
+
+extern void latencyStamp(pn_data_t *properties);
+extern latencyTracker *latencyCreate(const char *csvFile);
+extern void latencyRecord(latencyTracker *tracker, pn_message_t *message);
+extern void latencyTick(latencyTracker *tracker, bool force);
+extern void latencyFree(latencyTracker *tracker);
+
+#endif /* __LATENCY_H */
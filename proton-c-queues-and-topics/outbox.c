@@ -0,0 +1,497 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "common.h"
+#include "outbox.h"
+
+
+static void segmentPath(outbox *box, long sequence, char *path, size_t size)
+{
+    SNPRINTF(path, size, "%s/outbox.%08ld", box->directory, sequence);
+}
+
+
+static unsigned long long commitOffset(outboxSegment *segment)
+{
+    unsigned long long offset;
+    memcpy(&offset, segment->base + 8, 8);
+    return offset;
+}
+
+
+static void setCommitOffset(outboxSegment *segment, unsigned long long offset)
+{
+    memcpy(segment->base + 8, &offset, 8);
+    segment->headerDirty = true;
+}
+
+
+/*
+** Writes the given byte range of a segment through to the disk.
+*/
+static void flushRange(outboxSegment *segment, size_t from, size_t to)
+{
+#ifdef _WIN32
+    FlushViewOfFile(segment->base + from, to - from);
+    FlushFileBuffers((HANDLE)segment->fileHandle);
+#else
+    /* msync() wants a page-aligned start */
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = from - from % page;
+    msync(segment->base + start, to - start, MS_SYNC);
+#endif
+}
+
+
+static unsigned int recordLength(outboxSegment *segment, size_t offset)
+{
+    unsigned int length = 0;
+    if (offset + OUTBOX_RECORD_HEADER <= OUTBOX_SEGMENT_SIZE)
+    {
+        memcpy(&length, segment->base + offset, OUTBOX_RECORD_HEADER);
+    }
+    return length;
+}
+
+
+static void unmapSegment(outboxSegment *segment)
+{
+#ifdef _WIN32
+    if (segment->base != NULL)
+    {
+        FlushViewOfFile(segment->base, 0);
+        UnmapViewOfFile(segment->base);
+    }
+    if (segment->mappingHandle != NULL)
+    {
+        CloseHandle((HANDLE)segment->mappingHandle);
+    }
+    if ((segment->fileHandle != NULL) &&
+        (segment->fileHandle != INVALID_HANDLE_VALUE))
+    {
+        CloseHandle((HANDLE)segment->fileHandle);
+    }
+#else
+    if (segment->base != NULL)
+    {
+        msync(segment->base, OUTBOX_SEGMENT_SIZE, MS_ASYNC);
+        munmap(segment->base, OUTBOX_SEGMENT_SIZE);
+    }
+    if (segment->fd >= 0)
+    {
+        close(segment->fd);
+    }
+#endif
+    segment->base = NULL;
+}
+
+
+/*
+** Maps the segment file with the given sequence number, creating it at
+** full size if it does not exist yet.
+*/
+static int mapSegment(outbox *box, long sequence, outboxSegment *segment)
+{
+    char path[OUTBOX_MAX_PATH + 32];
+    segmentPath(box, sequence, path, sizeof(path));
+    memset(segment, 0, sizeof(outboxSegment));
+    segment->sequence = sequence;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    segment->fileHandle = file;
+    if (INVALID_HANDLE_VALUE == file)
+    {
+        printf("ERROR: cannot open outbox segment %s\n", path);
+        return -1;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0,
+        OUTBOX_SEGMENT_SIZE, NULL);
+    segment->mappingHandle = mapping;
+    segment->base = (NULL == mapping) ? NULL :
+        (char *)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+#else
+    struct stat info;
+    segment->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if ((segment->fd < 0) || (fstat(segment->fd, &info) != 0) ||
+        ((info.st_size < OUTBOX_SEGMENT_SIZE) &&
+         (ftruncate(segment->fd, OUTBOX_SEGMENT_SIZE) != 0)))
+    {
+        printf("ERROR: cannot open outbox segment %s\n", path);
+        return -1;
+    }
+    segment->base = (char *)mmap(NULL, OUTBOX_SEGMENT_SIZE,
+        PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (MAP_FAILED == (void *)segment->base)
+    {
+        segment->base = NULL;
+    }
+#endif
+    if (NULL == segment->base)
+    {
+        printf("ERROR: cannot map outbox segment %s\n", path);
+        unmapSegment(segment);
+        return -1;
+    }
+
+    if (0 == memcmp(segment->base, "\0\0\0\0\0\0\0\0", 8))
+    {
+        /* A new segment, the file system has already zeroed it */
+        memcpy(segment->base, OUTBOX_MAGIC, 8);
+        setCommitOffset(segment, OUTBOX_HEADER);
+    }
+    else if ((memcmp(segment->base, OUTBOX_MAGIC, 8) != 0) ||
+        (commitOffset(segment) < OUTBOX_HEADER) ||
+        (commitOffset(segment) > OUTBOX_SEGMENT_SIZE))
+    {
+        printf("ERROR: %s is not an outbox segment\n", path);
+        unmapSegment(segment);
+        return -1;
+    }
+
+    /* Find the end of the log; the next sync flushes all of it */
+    segment->syncedOffset = OUTBOX_HEADER;
+    segment->writeOffset = OUTBOX_HEADER;
+    for (;;)
+    {
+        unsigned int length = recordLength(segment, segment->writeOffset);
+        if ((0 == length) || (length > OUTBOX_SEGMENT_SIZE -
+            segment->writeOffset - OUTBOX_RECORD_HEADER))
+        {
+            break;
+        }
+        segment->writeOffset += OUTBOX_RECORD_HEADER + length;
+    }
+    return 0;
+}
+
+
+static void deleteSegment(outbox *box, outboxSegment *segment)
+{
+    char path[OUTBOX_MAX_PATH + 32];
+    segmentPath(box, segment->sequence, path, sizeof(path));
+    unmapSegment(segment);
+#ifdef _WIN32
+    DeleteFileA(path);
+#else
+    unlink(path);
+#endif
+}
+
+
+static int addSegment(outbox *box, long sequence)
+{
+    if (box->segmentCount == box->segmentCapacity)
+    {
+        int capacity = (0 == box->segmentCapacity) ? 16 :
+            box->segmentCapacity * 2;
+        outboxSegment *segments = (outboxSegment *)realloc(box->segments,
+            capacity * sizeof(outboxSegment));
+        if (NULL == segments)
+        {
+            return -1;
+        }
+        box->segments = segments;
+        box->segmentCapacity = capacity;
+    }
+    if (mapSegment(box, sequence, &box->segments[box->segmentCount]) != 0)
+    {
+        return -1;
+    }
+    box->segmentCount++;
+    if (sequence >= box->nextSequence)
+    {
+        box->nextSequence = sequence + 1;
+    }
+    return 0;
+}
+
+
+/*
+** Finds the oldest segment left in the directory, or returns -1.
+*/
+static long firstSequence(outbox *box)
+{
+    long first = -1;
+#ifdef _WIN32
+    char pattern[OUTBOX_MAX_PATH + 32];
+    WIN32_FIND_DATAA found;
+    SNPRINTF(pattern, sizeof(pattern), "%s/outbox.*", box->directory);
+    HANDLE search = FindFirstFileA(pattern, &found);
+    if (INVALID_HANDLE_VALUE == search)
+    {
+        return -1;
+    }
+    do
+    {
+        const char *name = found.cFileName;
+#else
+    DIR *dir = opendir(box->directory);
+    struct dirent *entry;
+    if (NULL == dir)
+    {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+#endif
+        char *end;
+        if (0 == strncmp(name, "outbox.", 7))
+        {
+            long sequence = strtol(name + 7, &end, 10);
+            if (('\0' == *end) && (end != name + 7) &&
+                ((first < 0) || (sequence < first)))
+            {
+                first = sequence;
+            }
+        }
+#ifdef _WIN32
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+#else
+    }
+    closedir(dir);
+#endif
+    return first;
+}
+
+
+int outboxOpen(outbox *box, const char *directory)
+{
+    long sequence;
+
+    memset(box, 0, sizeof(outbox));
+    SNPRINTF(box->directory, sizeof(box->directory), "%s", directory);
+#ifdef _WIN32
+    CreateDirectoryA(directory, NULL);
+#else
+    mkdir(directory, 0755);
+#endif
+
+    /* Segments are numbered consecutively from the oldest */
+    sequence = firstSequence(box);
+    if (sequence >= 0)
+    {
+        for (;; sequence++)
+        {
+            char path[OUTBOX_MAX_PATH + 32];
+            FILE *probe;
+            segmentPath(box, sequence, path, sizeof(path));
+            probe = fopen(path, "rb");
+            if (NULL == probe)
+            {
+                break;
+            }
+            fclose(probe);
+            if (addSegment(box, sequence) != 0)
+            {
+                outboxClose(box);
+                return -1;
+            }
+        }
+    }
+    if ((0 == box->segmentCount) && (addSegment(box, 0) != 0))
+    {
+        outboxClose(box);
+        return -1;
+    }
+
+    /* Count what the last run left behind */
+    int i;
+    for (i = 0; i < box->segmentCount; i++)
+    {
+        outboxSegment *segment = &box->segments[i];
+        size_t offset = (size_t)commitOffset(segment);
+        while (offset < segment->writeOffset)
+        {
+            offset += OUTBOX_RECORD_HEADER + recordLength(segment, offset);
+            box->pending++;
+        }
+    }
+    box->sendSegment = 0;
+    box->sendOffset = (size_t)commitOffset(&box->segments[0]);
+    if (box->pending > 0)
+    {
+        printf("Outbox %s holds %lld messages from an earlier run\n",
+            directory, box->pending);
+    }
+    return 0;
+}
+
+
+int outboxAppend(outbox *box, const char *bytes, size_t size)
+{
+    unsigned int length = (unsigned int)size;
+    outboxSegment *tail = &box->segments[box->segmentCount - 1];
+
+    if ((0 == size) || (size > OUTBOX_MAX_MESSAGE))
+    {
+        printf("Message of %lu bytes cannot go in the outbox\n",
+            (unsigned long)size);
+        return -1;
+    }
+    /* Always leave room for the zero length that ends the segment */
+    if (tail->writeOffset + 2 * OUTBOX_RECORD_HEADER + size >
+        OUTBOX_SEGMENT_SIZE)
+    {
+        if (addSegment(box, box->nextSequence) != 0)
+        {
+            return -1;
+        }
+        tail = &box->segments[box->segmentCount - 1];
+    }
+
+    memcpy(tail->base + tail->writeOffset + OUTBOX_RECORD_HEADER, bytes, size);
+    memcpy(tail->base + tail->writeOffset, &length, OUTBOX_RECORD_HEADER);
+    tail->writeOffset += OUTBOX_RECORD_HEADER + size;
+    box->pending++;
+    return 0;
+}
+
+
+/*
+** Returns the record under the send cursor, pointing into the mapped
+** segment, and moves the cursor past it.
+*/
+bool outboxNext(outbox *box, const char **bytes, size_t *size)
+{
+    outboxSegment *segment = &box->segments[box->sendSegment];
+    while (box->sendOffset >= segment->writeOffset)
+    {
+        if (box->sendSegment + 1 >= box->segmentCount)
+        {
+            return false;
+        }
+        box->sendSegment++;
+        segment = &box->segments[box->sendSegment];
+        box->sendOffset = OUTBOX_HEADER;
+    }
+
+    *size = recordLength(segment, box->sendOffset);
+    *bytes = segment->base + box->sendOffset + OUTBOX_RECORD_HEADER;
+    box->sendOffset += OUTBOX_RECORD_HEADER + *size;
+    box->inFlight++;
+    return true;
+}
+
+
+/*
+** Moves the commit cursor past the oldest count records in flight, and
+** deletes each segment the cursor leaves behind.
+*/
+void outboxAccept(outbox *box, long count)
+{
+    while ((count > 0) && (box->inFlight > 0))
+    {
+        outboxSegment *head = &box->segments[0];
+        size_t offset = (size_t)commitOffset(head);
+        if (offset >= head->writeOffset)
+        {
+            if (box->segmentCount < 2)
+            {
+                break;
+            }
+            deleteSegment(box, head);
+            memmove(&box->segments[0], &box->segments[1],
+                (box->segmentCount - 1) * sizeof(outboxSegment));
+            box->segmentCount--;
+            box->sendSegment--;
+            continue;
+        }
+        offset += OUTBOX_RECORD_HEADER + recordLength(head, offset);
+        setCommitOffset(head, offset);
+        box->pending--;
+        box->inFlight--;
+        count--;
+    }
+
+    /* Do not keep a finished segment around until the next accept */
+    while ((box->segmentCount > 1) && (box->sendSegment > 0) &&
+        (commitOffset(&box->segments[0]) >= box->segments[0].writeOffset))
+    {
+        deleteSegment(box, &box->segments[0]);
+        memmove(&box->segments[0], &box->segments[1],
+            (box->segmentCount - 1) * sizeof(outboxSegment));
+        box->segmentCount--;
+        box->sendSegment--;
+    }
+}
+
+
+/*
+** Flushes to disk the records appended and the commit offsets moved since
+** the last sync. One sync covers any number of appends and accepts.
+*/
+void outboxSync(outbox *box)
+{
+    int i;
+    for (i = 0; i < box->segmentCount; i++)
+    {
+        outboxSegment *segment = &box->segments[i];
+        if (segment->headerDirty)
+        {
+            flushRange(segment, 0, OUTBOX_HEADER);
+            segment->headerDirty = false;
+        }
+        if (segment->syncedOffset < segment->writeOffset)
+        {
+            flushRange(segment, segment->syncedOffset, segment->writeOffset);
+            segment->syncedOffset = segment->writeOffset;
+        }
+    }
+}
+
+
+/*
+** Moves the send cursor back to the commit cursor, so that everything
+** not yet accepted is sent again.
+*/
+void outboxRetry(outbox *box)
+{
+    box->sendSegment = 0;
+    box->sendOffset = (size_t)commitOffset(&box->segments[0]);
+    box->inFlight = 0;
+}
+
+
+void outboxClose(outbox *box)
+{
+    int i;
+    outboxSync(box);
+    for (i = 0; i < box->segmentCount; i++)
+    {
+        unmapSegment(&box->segments[i]);
+    }
+    free(box->segments);
+    box->segments = NULL;
+    box->segmentCount = 0;
+    box->segmentCapacity = 0;
+}
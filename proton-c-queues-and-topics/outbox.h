@@ -0,0 +1,89 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __OUTBOX_H
+#define __OUTBOX_H
+
+#include <stddef.h>
+#include "proton/types.h"
+
+/*
+** A store-and-forward outbox: a log of encoded messages kept in a
+** directory of fixed-size, memory-mapped segment files. Messages are
+** appended at the tail and shipped from a send cursor. A commit cursor
+** follows behind as deliveries are accepted. Each segment is deleted once
+** everything in it has been accepted, so the log only holds what the
+** broker has not yet taken.
+**
+** Segment file layout, in the byte order of the machine that wrote it:
+**
+**   header  8 bytes  OUTBOX_MAGIC
+**           8 bytes  commit offset: first record not yet accepted
+**   record  4 bytes  length of the encoded message, 0 ends the segment
+**           n bytes  the message as pn_message_encode() wrote it
+**
+** A record's length is stored after its bytes, so a process that dies
+** mid-append leaves a clean end of log. Reopening the directory resumes
+** from the commit offset, and records that had been sent but not yet
+** accepted are sent again. What is appended or committed survives the
+** process dying at once, and the machine going down once outboxSync()
+** has flushed it to disk.
+*/
+#define OUTBOX_MAGIC		"SBOUTBX1"
+#define OUTBOX_HEADER		16
+#define OUTBOX_RECORD_HEADER	4
+#define OUTBOX_SEGMENT_SIZE	(16 * 1024 * 1024)
+#define OUTBOX_MAX_MESSAGE	(OUTBOX_SEGMENT_SIZE - OUTBOX_HEADER - \
+				 2 * OUTBOX_RECORD_HEADER)
+#define OUTBOX_MAX_PATH		400
+
+typedef struct outboxSegment
+{
+    long sequence;
+    char *base;
+    size_t writeOffset;   /* where the next record goes */
+    size_t syncedOffset;  /* records before this are on disk */
+    bool headerDirty;     /* the commit offset changed since the sync */
+#ifdef _WIN32
+    void *fileHandle;
+    void *mappingHandle;
+#else
+    int fd;
+#endif
+} outboxSegment;
+
+typedef struct outbox
+{
+    char directory[OUTBOX_MAX_PATH];
+    outboxSegment *segments;  /* oldest first */
+    int segmentCount;
+    int segmentCapacity;
+    long nextSequence;
+    int sendSegment;          /* the send cursor */
+    size_t sendOffset;
+    long long pending;        /* appended but not yet accepted */
+    long long inFlight;       /* sent but not yet accepted */
+} outbox;
+
+extern int outboxOpen(outbox *box, const char *directory);
+extern int outboxAppend(outbox *box, const char *bytes, size_t size);
+extern bool outboxNext(outbox *box, const char **bytes, size_t *size);
+extern void outboxAccept(outbox *box, long count);
+extern void outboxRetry(outbox *box);
+extern void outboxSync(outbox *box);
+extern void outboxClose(outbox *box);
+
+#endif /* __OUTBOX_H */
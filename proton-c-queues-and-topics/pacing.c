@@ -0,0 +1,226 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "proton/messenger.h"
+#include "proton/error.h"
+#ifndef PN_VERSION_MAJOR
+#include "proton/version.h"
+#endif
+
+#include "common.h"
+#include "pacing.h"
+
+
+void pacerInit(pacer *p, double rate, double burst)
+{
+    memset(p, 0, sizeof(pacer));
+    p->rate = rate;
+    p->maxRate = rate;
+    p->burst = (burst < 1.0) ? 1.0 : burst;
+    p->tokens = p->burst;
+    p->last = currentMicros();
+    p->lastReport = p->last;
+}
+
+
+static void pacerRefill(pacer *p, long long now)
+{
+    p->tokens += (now - p->last) * p->rate / 1000000.0;
+    if (p->tokens > p->burst)
+    {
+        p->tokens = p->burst;
+    }
+    p->last = now;
+}
+
+
+/*
+** How many microseconds pacerWait() would block for right now.
+*/
+long long pacerDelay(pacer *p)
+{
+    long long now = currentMicros();
+    if (now < p->pauseUntil)
+    {
+        return p->pauseUntil - now;
+    }
+    pacerRefill(p, now);
+    if (p->tokens >= 1.0)
+    {
+        return 0;
+    }
+    return (long long)((1.0 - p->tokens) * 1000000.0 / p->rate) + 1;
+}
+
+
+/*
+** Blocks until the bucket holds a token, then takes it.
+*/
+void pacerWait(pacer *p)
+{
+    long long now = currentMicros();
+
+    if (now < p->pauseUntil)
+    {
+        sleepMicros(p->pauseUntil - now);
+        now = currentMicros();
+        /* Tokens do not accumulate during a pause */
+        p->last = now;
+    }
+    pacerRefill(p, now);
+    while (p->tokens < 1.0)
+    {
+        sleepMicros((long long)((1.0 - p->tokens) * 1000000.0 / p->rate) + 1);
+        pacerRefill(p, currentMicros());
+    }
+    p->tokens -= 1.0;
+    p->sent++;
+    pacerReport(p, false);
+}
+
+
+static void pacerBackoff(pacer *p)
+{
+    double floor = (p->maxRate < PACING_MIN_RATE) ? p->maxRate :
+        PACING_MIN_RATE;
+
+    p->throttled++;
+    if (p->cut)
+    {
+        /* The whole window was sent at the same rate, so one cut will do */
+        return;
+    }
+    if (!p->backingOff)
+    {
+        p->ceiling = p->rate;
+    }
+    p->cut = true;
+    p->backingOff = true;
+    p->rate *= PACING_BACKOFF_FACTOR;
+    if (p->rate < floor)
+    {
+        p->rate = floor;
+    }
+    /* Drop any saved-up burst so the cut takes effect immediately */
+    if (p->tokens > 1.0)
+    {
+        p->tokens = 1.0;
+    }
+    p->accepted = 0;
+}
+
+
+/*
+** Starts a new window of outcomes, each of which may cut the rate once.
+*/
+void pacerWindow(pacer *p)
+{
+    p->cut = false;
+}
+
+
+/*
+** Feeds the final status of one send into the rate controller.
+*/
+void pacerOutcome(pacer *p, pn_status_t status)
+{
+    switch (status)
+    {
+    case PN_STATUS_ACCEPTED:
+        p->pause = 0;
+        if (++p->accepted >= PACING_RECOVERY_BATCH)
+        {
+            p->accepted = 0;
+            p->backingOff = false;
+            if ((p->ceiling > 0) && (p->rate < p->ceiling * 0.9))
+            {
+                p->rate *= PACING_RECOVERY_FACTOR;
+            }
+            else
+            {
+                p->rate += p->maxRate * PACING_PROBE_STEP;
+            }
+            if (p->rate > p->maxRate)
+            {
+                p->rate = p->maxRate;
+            }
+        }
+        break;
+
+    case PN_STATUS_REJECTED:
+#if (PN_VERSION_MINOR > 4)
+    case PN_STATUS_MODIFIED:
+#endif
+#if (PN_VERSION_MINOR > 5)
+    case PN_STATUS_RELEASED:
+#endif
+        pacerBackoff(p);
+        break;
+
+    default:
+        /* Pending, unknown and the like say nothing about load */
+        break;
+    }
+}
+
+
+/*
+** Server busy means the entity is being throttled as a whole, so besides
+** cutting the rate, stop sending for a while. The pause doubles on each
+** consecutive server-busy error and resets on the next accepted message.
+*/
+void pacerServerBusy(pacer *p)
+{
+    pacerBackoff(p);
+    p->pause = (0 == p->pause) ? 100000LL : (p->pause * 2);
+    if (p->pause > PACING_MAX_PAUSE)
+    {
+        p->pause = PACING_MAX_PAUSE;
+    }
+    p->pauseUntil = currentMicros() + p->pause;
+    printf("Server busy, pausing %lld ms\n", p->pause / 1000);
+}
+
+
+/*
+** Service Bus reports throttling with the com.microsoft:server-busy
+** error condition.
+*/
+bool isServerBusy(pn_messenger_t *messenger)
+{
+#if (PN_VERSION_MINOR == 4)
+    const char *text = pn_messenger_error(messenger);
+#else
+    const char *text = pn_error_text(pn_messenger_error(messenger));
+#endif
+    return (text != NULL) &&
+        ((strstr(text, "server-busy") != NULL) ||
+         (strstr(text, "ServerBusy") != NULL));
+}
+
+
+void pacerReport(pacer *p, bool force)
+{
+    long long now = currentMicros();
+    if (force || (now - p->lastReport >= PACING_REPORT_INTERVAL))
+    {
+        printf("PACING rate=%.1f/s max=%.1f/s sent=%lld throttled=%lld\n",
+            p->rate, p->maxRate, p->sent, p->throttled);
+        p->lastReport = now;
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __PACING_H
+#define __PACING_H
+
+#include "proton/messenger.h"
+
+/*
+** A token bucket that paces sends at a target rate, plus a controller
+** that adapts the rate to what the broker will take. Throttling outcomes
+** (released, modified, rejected, or a server-busy error) cut the rate
+** multiplicatively, at most once per window of outcomes; runs of accepted
+** messages raise it again, quickly up to just below the rate at which
+** throttling began and cautiously beyond.
+*/
+#define PACING_BACKOFF_FACTOR	0.5
+#define PACING_RECOVERY_FACTOR	1.1
+#define PACING_PROBE_STEP	0.01	/* fraction of the maximum rate */
+#define PACING_RECOVERY_BATCH	50	/* accepted messages per increase */
+#define PACING_MIN_RATE		1.0
+#define PACING_MAX_PAUSE	10000000LL	/* microseconds */
+#define PACING_REPORT_INTERVAL	5000000LL	/* microseconds */
+#define PACING_FLUSH_WAIT	20000LL		/* microseconds */
+
+typedef struct pacer
+{
+    double rate;          /* current messages per second */
+    double maxRate;       /* the configured rate, never exceeded */
+    double ceiling;       /* rate throttling began at, 0 if none yet */
+    double burst;         /* bucket size */
+    double tokens;
+    long long last;       /* currentMicros() of the last refill */
+    long long pauseUntil;
+    long long pause;      /* current server-busy pause, doubles each time */
+    int accepted;         /* accepted since the last rate increase */
+    bool cut;             /* the rate was cut in this window */
+    bool backingOff;      /* cut since the last increase */
+    long long sent;
+    long long throttled;
+    long long lastReport;
+} pacer;
+
+extern void pacerInit(pacer *p, double rate, double burst);
+extern long long pacerDelay(pacer *p);
+extern void pacerWait(pacer *p);
+extern void pacerWindow(pacer *p);
+extern void pacerOutcome(pacer *p, pn_status_t status);
+extern void pacerServerBusy(pacer *p);
+extern bool isServerBusy(pn_messenger_t *messenger);
+extern void pacerReport(pacer *p, bool force);
+
+#endif /* __PACING_H */
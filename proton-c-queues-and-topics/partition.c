@@ -0,0 +1,486 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proton/message.h"
+#include "proton/messenger.h"
+#include "proton/error.h"
+#ifndef PN_VERSION_MAJOR
+#include "proton/version.h"
+#endif
+
+#include "common.h"
+#include "latency.h"
+#include "partition.h"
+
+/* How long one pass of the sender loop waits for network activity */
+#define PARTITION_POLL	10
+
+
+/* 32-bit FNV-1a, stable across runs and platforms */
+unsigned int partitionHash(const char *key, size_t length)
+{
+    unsigned int hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+#if (PN_VERSION_MINOR > 7)
+/* A message in flight, with the partition it is counted against */
+typedef struct partitionFlight
+{
+    pn_tracker_t tracker;
+    long long sentAt;
+    int partition;
+} partitionFlight;
+
+
+static void partitionKey(int index, char *key, size_t size)
+{
+    SNPRINTF(key, size, "key-%d", index);
+}
+
+
+static void setupPartitioned(pn_message_t *message, char *address,
+                             const char *key, long long sequence,
+                             bool sessions)
+{
+    char text[64];
+    pn_uuid_t id;
+    pn_atom_t atom;
+
+    pn_message_clear(message);
+    pn_message_set_address(message, address);
+
+    generateUuid(&id);
+    atom.type = PN_UUID;
+    atom.u.as_uuid = id;
+    pn_message_set_id(message, atom);
+    if (sessions)
+    {
+        /* Service Bus requires the partition key to equal the SessionId */
+        pn_message_set_group_id(message, key);
+    }
+
+    pn_data_t *annotations = pn_message_annotations(message);
+    pn_data_put_map(annotations);
+    pn_data_enter(annotations);
+    pn_data_put_symbol(annotations, pn_bytes(strlen("x-opt-partition-key"),
+        "x-opt-partition-key"));
+    pn_data_put_string(annotations, pn_bytes(strlen(key), key));
+    pn_data_exit(annotations);
+
+    pn_data_t *properties = pn_message_properties(message);
+    pn_data_put_map(properties);
+    pn_data_enter(properties);
+    pn_data_put_string(properties, pn_bytes(strlen("MessageType"),
+        "MessageType"));
+    pn_data_put_string(properties, pn_bytes(strlen("TextMessage"),
+        "TextMessage"));
+    pn_data_put_string(properties, pn_bytes(strlen("PartitionSequence"),
+        "PartitionSequence"));
+    pn_data_put_long(properties, sequence);
+    latencyStamp(properties);
+    pn_data_exit(properties);
+
+    SNPRINTF(text, sizeof(text), "Message %lld for %s", sequence, key);
+    pn_data_put_string(pn_message_body(message), pn_bytes(strlen(text), text));
+}
+
+
+/*
+** Retires messages from the front of the window once they have a final
+** outcome, counting each against its partition. Messages behind an
+** undecided one wait for it, which keeps retirement in sending order.
+** Returns how many were retired.
+*/
+static long partitionRetire(pn_messenger_t *messenger, partitionState *states,
+                            partitionFlight *flights, int *head,
+                            int *inFlight, long long now)
+{
+    long retired = 0;
+
+    while (*inFlight > 0)
+    {
+        partitionFlight *flight = &flights[*head];
+        partitionState *state = &states[flight->partition];
+        pn_status_t status = pn_messenger_status(messenger, flight->tracker);
+        if (!isFinalStatus(status))
+        {
+            break;
+        }
+        if (PN_STATUS_ACCEPTED == status)
+        {
+            state->accepted++;
+        }
+        else
+        {
+            state->failed++;
+        }
+        long long ack = now - flight->sentAt;
+        state->ackSum += ack;
+        if (ack > state->ackMax)
+        {
+            state->ackMax = ack;
+        }
+        pn_messenger_settle(messenger, flight->tracker, 0);
+        *head = (*head + 1) % PARTITION_WINDOW;
+        (*inFlight)--;
+        retired++;
+    }
+    return retired;
+}
+
+
+static void partitionReport(partitionState *states, int partitions,
+                            long long elapsed)
+{
+    long total = 0;
+    long most = 0;
+    int p;
+
+    printf("PARTITION  KEYS      SENT  ACCEPTED  FAILED  ACK-AVG-MS  "
+        "ACK-MAX-MS\n");
+    for (p = 0; p < partitions; p++)
+    {
+        partitionState *state = &states[p];
+        long done = state->accepted + state->failed;
+        double average = (done > 0) ? (state->ackSum / done / 1000.0) : 0.0;
+        printf("%9d %5d %9ld %9ld %7ld %11.2f %11.2f\n", p, state->keys,
+            state->sent, state->accepted, state->failed, average,
+            state->ackMax / 1000.0);
+        total += state->sent;
+        if (state->sent > most)
+        {
+            most = state->sent;
+        }
+    }
+
+    /*
+    ** Skew is the busiest partition's share against an even split. Every
+    ** message shares one link and window, so acknowledgement times show
+    ** when a message was sent more than which partition it belongs to.
+    */
+    double mean = (double)total / partitions;
+    printf("Partition skew: busiest %.2fx the mean load, over %.3f s\n",
+        (mean > 0) ? (most / mean) : 0.0, elapsed / 1000000.0);
+}
+#endif
+
+
+/*
+** Sends count messages spread round robin over keys partition keys, all
+** over one link with one window of messages in flight. This is keyed
+** sending with a skew report: keys map to the sender's own partitions by
+** hash, so partitions own different numbers of keys, and the report shows
+** how unevenly that spreads the load. The partitions are buckets for
+** counting, not the broker's partitions, and do not pace separately.
+*/
+int partitionSend(pn_messenger_t *messenger, pn_message_t *message,
+                  char *address, long count, int partitions, int keys,
+                  bool sessions)
+{
+#if (PN_VERSION_MINOR > 7)
+    partitionState *states =
+        (partitionState *)calloc(partitions, sizeof(partitionState));
+    partitionFlight *flights =
+        (partitionFlight *)malloc(PARTITION_WINDOW * sizeof(partitionFlight));
+    int *keyPartitions = (int *)malloc(keys * sizeof(int));
+    long long *keySequences = (long long *)calloc(keys, sizeof(long long));
+    char key[32];
+    long produced = 0;
+    long finished = 0;
+    int head = 0;
+    int inFlight = 0;
+    int result = 0;
+    int err;
+    int k;
+
+    if ((NULL == states) || (NULL == flights) || (NULL == keyPartitions) ||
+        (NULL == keySequences))
+    {
+        printf("ERROR: cannot allocate %d partitions\n", partitions);
+        free(states);
+        free(flights);
+        free(keyPartitions);
+        free(keySequences);
+        return -1;
+    }
+    for (k = 0; k < keys; k++)
+    {
+        partitionKey(k, key, sizeof(key));
+        keyPartitions[k] = (int)(partitionHash(key, strlen(key)) % partitions);
+        states[keyPartitions[k]].keys++;
+    }
+
+    printf("Sending %ld messages over %d keys in %d partitions, up to %d in "
+        "flight%s\n", count, keys, partitions, PARTITION_WINDOW,
+        sessions ? ", with sessions" : "");
+    long long start = currentMicros();
+
+    while (finished < count)
+    {
+        long long now = currentMicros();
+
+        /* Fill the window in key order; one slow key holds up the rest */
+        while ((produced < count) && (inFlight < PARTITION_WINDOW))
+        {
+            k = (int)(produced % keys);
+            partitionState *state = &states[keyPartitions[k]];
+            partitionKey(k, key, sizeof(key));
+            setupPartitioned(message, address, key, keySequences[k],
+                sessions);
+            err = pn_messenger_put(messenger, message);
+            if (err != 0)
+            {
+                protonError(err, "pn_messenger_put", messenger);
+                state->failed++;
+                finished++;
+            }
+            else
+            {
+                partitionFlight *flight =
+                    &flights[(head + inFlight) % PARTITION_WINDOW];
+                flight->tracker = pn_messenger_outgoing_tracker(messenger);
+                flight->sentAt = now;
+                flight->partition = keyPartitions[k];
+                inFlight++;
+                state->sent++;
+            }
+            keySequences[k]++;
+            produced++;
+        }
+
+        err = pn_messenger_send(messenger, -1);
+        if ((err != 0) && (err != PN_INPROGRESS))
+        {
+            protonError(err, "pn_messenger_send", messenger);
+        }
+        err = pn_messenger_work(messenger, PARTITION_POLL);
+        if ((err < 0) && (err != PN_TIMEOUT) && (err != PN_INPROGRESS))
+        {
+            protonError(err, "pn_messenger_work", messenger);
+            result = -1;
+            break;
+        }
+
+        finished += partitionRetire(messenger, states, flights, &head,
+            &inFlight, currentMicros());
+    }
+
+    partitionReport(states, partitions, currentMicros() - start);
+
+    free(states);
+    free(flights);
+    free(keyPartitions);
+    free(keySequences);
+    return result;
+#else
+    /*
+    ** Keeping a window of messages in flight needs nonblocking sends and
+    ** pn_messenger_work(), which are only usable from Proton-C 0.8 on.
+    */
+    printf("Partitioned sending requires Proton-C 0.8 or later\n");
+    return -1;
+#endif
+}
+
+
+orderTracker *orderCreate(void)
+{
+    orderTracker *tracker = (orderTracker *)calloc(1, sizeof(orderTracker));
+    if (tracker != NULL)
+    {
+        tracker->entries =
+            (orderEntry *)calloc(ORDER_MAX_KEYS, sizeof(orderEntry));
+        if (NULL == tracker->entries)
+        {
+            free(tracker);
+            tracker = NULL;
+        }
+    }
+    if (NULL == tracker)
+    {
+        printf("ERROR: cannot allocate the ordering table\n");
+    }
+    return tracker;
+}
+
+
+static orderEntry *orderFind(orderTracker *tracker, const char *key,
+                             size_t length)
+{
+    size_t mask = ORDER_MAX_KEYS - 1;
+    size_t slot = partitionHash(key, length) & mask;
+
+    if (length >= ORDER_KEY_SIZE)
+    {
+        length = ORDER_KEY_SIZE - 1;
+    }
+    while (tracker->entries[slot].used)
+    {
+        orderEntry *entry = &tracker->entries[slot];
+        if ((strlen(entry->key) == length) &&
+            (0 == memcmp(entry->key, key, length)))
+        {
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    /* Keep a quarter of the table free so probe sequences stay short */
+    if (tracker->keys >= ORDER_MAX_KEYS / 4 * 3)
+    {
+        return NULL;
+    }
+    orderEntry *entry = &tracker->entries[slot];
+    memcpy(entry->key, key, length);
+    entry->key[length] = '\0';
+    entry->last = -1;
+    entry->used = true;
+    tracker->keys++;
+    return entry;
+}
+
+
+/*
+** Checks a message against the last PartitionSequence seen for its key,
+** taken from x-opt-partition-key or, failing that, the group id, and
+** counts it against the broker partition in its sequence number, whose
+** top 16 bits are the partition on partitioned entities.
+*/
+void orderRecord(orderTracker *tracker, pn_message_t *message)
+{
+    pn_data_t *annotations = pn_message_annotations(message);
+    pn_data_t *properties = pn_message_properties(message);
+    pn_bytes_t key;
+    long long sequence = -1;
+    char keyCopy[ORDER_KEY_SIZE];
+    bool keyed = false;
+    const char *groupId = pn_message_get_group_id(message);
+
+    if (findProperty(annotations, "x-opt-sequence-number") &&
+        (PN_LONG == pn_data_type(annotations)))
+    {
+        long long brokerSequence = (long long)pn_data_get_long(annotations);
+        tracker->brokerCounts[(brokerSequence >> 48) & 0xFFFF]++;
+    }
+    pn_data_rewind(annotations);
+
+    if (findProperty(annotations, "x-opt-partition-key") &&
+        (PN_STRING == pn_data_type(annotations)))
+    {
+        key = pn_data_get_bytes(annotations);
+        keyed = true;
+    }
+    else if (groupId != NULL)
+    {
+        key = pn_bytes(strlen(groupId), groupId);
+        keyed = true;
+    }
+    if (keyed)
+    {
+        /* The key points into annotations, which is rewound below */
+        size_t length = (key.size < sizeof(keyCopy)) ? key.size :
+            sizeof(keyCopy) - 1;
+        memcpy(keyCopy, key.start, length);
+        keyCopy[length] = '\0';
+    }
+    pn_data_rewind(annotations);
+
+    if (findProperty(properties, "PartitionSequence") &&
+        (PN_LONG == pn_data_type(properties)))
+    {
+        sequence = (long long)pn_data_get_long(properties);
+    }
+    pn_data_rewind(properties);
+
+    if (!keyed || (sequence < 0))
+    {
+        tracker->unkeyed++;
+        return;
+    }
+
+    orderEntry *entry = orderFind(tracker, keyCopy, strlen(keyCopy));
+    if (NULL == entry)
+    {
+        tracker->unkeyed++;
+    }
+    else if ((sequence == entry->last + 1) || (entry->last < 0))
+    {
+        tracker->inOrder++;
+        entry->last = sequence;
+    }
+    else if (sequence > entry->last)
+    {
+        tracker->gaps++;
+        entry->last = sequence;
+    }
+    else
+    {
+        tracker->reordered++;
+    }
+}
+
+
+void orderReport(orderTracker *tracker)
+{
+    long total = 0;
+    long most = 0;
+    int used = 0;
+    int p;
+
+    printf("ORDERING keys=%lu in-order=%ld gaps=%ld reordered=%ld "
+        "unkeyed=%ld\n", (unsigned long)tracker->keys, tracker->inOrder,
+        tracker->gaps, tracker->reordered, tracker->unkeyed);
+    for (p = 0; p < ORDER_BROKER_PARTITIONS; p++)
+    {
+        if (tracker->brokerCounts[p] > 0)
+        {
+            printf("  broker partition %d: %ld messages\n", p,
+                tracker->brokerCounts[p]);
+            total += tracker->brokerCounts[p];
+            if (tracker->brokerCounts[p] > most)
+            {
+                most = tracker->brokerCounts[p];
+            }
+            used++;
+        }
+    }
+    if (used > 1)
+    {
+        printf("  busiest partition %.2fx the mean\n",
+            most / ((double)total / used));
+    }
+}
+
+
+void orderFree(orderTracker *tracker)
+{
+    if (tracker != NULL)
+    {
+        free(tracker->entries);
+        free(tracker);
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __PARTITION_H
+#define __PARTITION_H
+
+#include "proton/message.h"
+#include "proton/messenger.h"
+
+/*
+** Sending to partitioned entities. Each message carries a partition key,
+** in the x-opt-partition-key annotation and, with sessions, as its
+** group id (SessionId), and Service Bus stores messages with the same key
+** in the same partition, in order. This is keyed sending with a skew
+** report: every message goes over one link with one window in flight,
+** and the sender hashes each key to one of its own partitions only to
+** count how unevenly the keys spread the load. A PartitionSequence
+** property numbers the messages of each key, which the receiver uses to
+** check per-key ordering.
+*/
+#define PARTITION_DEFAULT_COUNT	16
+#define PARTITION_MAX_COUNT	256
+#define PARTITION_DEFAULT_KEYS	64
+#define PARTITION_WINDOW	256
+
+typedef struct partitionState
+{
+    int keys;
+    long sent;
+    long accepted;
+    long failed;
+    double ackSum;               /* microseconds */
+    long long ackMax;
+} partitionState;
+
+/*
+** Receiver side: the last PartitionSequence seen for each key, in an
+** open-addressing table, and messages seen per broker partition, one
+** counter for every value of the top 16 bits of the sequence number.
+*/
+#define ORDER_MAX_KEYS		65536
+#define ORDER_KEY_SIZE		64
+#define ORDER_BROKER_PARTITIONS	65536
+
+typedef struct orderEntry
+{
+    char key[ORDER_KEY_SIZE];
+    long long last;
+    bool used;
+} orderEntry;
+
+typedef struct orderTracker
+{
+    orderEntry *entries;
+    size_t keys;
+    long inOrder;
+    long gaps;
+    long reordered;           /* duplicates or going backwards */
+    long unkeyed;
+    long brokerCounts[ORDER_BROKER_PARTITIONS];
+} orderTracker;
+
+extern unsigned int partitionHash(const char *key, size_t length);
+extern int partitionSend(pn_messenger_t *messenger, pn_message_t *message,
+                         char *address, long count, int partitions,
+                         int keys, bool sessions);
+
+extern orderTracker *orderCreate(void);
+extern void orderRecord(orderTracker *tracker, pn_message_t *message);
+extern void orderReport(orderTracker *tracker);
+extern void orderFree(orderTracker *tracker);
+
+#endif /* __PARTITION_H */
@@ -0,0 +1,465 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proton/message.h"
+#include "proton/messenger.h"
+#include "proton/error.h"
+#ifndef PN_VERSION_MAJOR
+#include "proton/version.h"
+#endif
+
+#include "common.h"
+#include "histogram.h"
+#include "latency.h"
+#include "priority.h"
+
+/* How long one pass of the sender loop waits for network activity */
+#define PRIORITY_POLL	10
+
+typedef struct priorityFlight
+{
+    pn_tracker_t tracker;
+    int cls;
+    size_t size;
+    long long arrival;
+} priorityFlight;
+
+
+/*
+** Parses a workload specification into classes, returning how many there
+** are, or -1 after explaining what is wrong.
+*/
+int priorityParse(const char *spec, priorityClass *classes, int max)
+{
+    char copy[1024];
+    char text[1024];
+    char *next;
+    char *item;
+    int count = 0;
+    int strict = 0;
+
+    SNPRINTF(copy, sizeof(copy), "%s", spec);
+    for (item = copy; item != NULL; item = next)
+    {
+        char *fields[5];
+        int n = 0;
+        char *field = item;
+
+        next = strchr(item, ',');
+        if (next != NULL)
+        {
+            *next++ = '\0';
+        }
+
+        /* Splitting item into fields cuts it short, so keep it whole */
+        SNPRINTF(text, sizeof(text), "%s", item);
+        while ((field != NULL) && (n < 5))
+        {
+            fields[n++] = field;
+            field = strchr(field, ':');
+            if (field != NULL)
+            {
+                *field++ = '\0';
+            }
+        }
+        if ((n < 4) || (field != NULL) || (count == max))
+        {
+            printf("Bad priority class \"%s\": expected "
+                "name:weight:count:size[:rate], at most %d classes\n",
+                text, max);
+            return -1;
+        }
+
+        priorityClass *cls = &classes[count];
+        memset(cls, 0, sizeof(priorityClass));
+        SNPRINTF(cls->name, sizeof(cls->name), "%s", fields[0]);
+        cls->strict = (0 == strcmp(fields[1], "strict"));
+        cls->weight = cls->strict ? 0 : atoi(fields[1]);
+        cls->count = strtol(fields[2], NULL, 10);
+        cls->size = (size_t)strtoul(fields[3], NULL, 10);
+        cls->rate = (n > 4) ? strtod(fields[4], NULL) : 0.0;
+        if (!cls->strict && (cls->weight < 1))
+        {
+            printf("Bad priority class \"%s\": weight must be \"strict\" or "
+                "at least 1\n", text);
+            return -1;
+        }
+        if (cls->count < 0)
+        {
+            printf("Bad priority class \"%s\": count cannot be negative\n",
+                text);
+            return -1;
+        }
+        if (cls->size > PRIORITY_MAX_SIZE)
+        {
+            printf("Bad priority class \"%s\": size must be at most %d\n",
+                text, PRIORITY_MAX_SIZE);
+            return -1;
+        }
+        if (cls->rate < 0)
+        {
+            printf("Bad priority class \"%s\": rate cannot be negative\n",
+                text);
+            return -1;
+        }
+        strict += cls->strict ? 1 : 0;
+        count++;
+    }
+    if (strict > 1)
+    {
+        printf("Only one priority class can be strict\n");
+        return -1;
+    }
+    return count;
+}
+
+
+#if (PN_VERSION_MINOR > 7)
+static long long arrivalTime(priorityClass *cls, long index, long long start)
+{
+    if (cls->rate <= 0)
+    {
+        return start;
+    }
+    return start + (long long)(index * 1000000.0 / cls->rate);
+}
+
+
+static void setupPrioritized(pn_message_t *message, char *address,
+                             priorityClass *cls, int rank, const char *body)
+{
+    pn_uuid_t id;
+    pn_atom_t atom;
+
+    pn_message_clear(message);
+    pn_message_set_address(message, address);
+    generateUuid(&id);
+    atom.type = PN_UUID;
+    atom.u.as_uuid = id;
+    pn_message_set_id(message, atom);
+
+    /* AMQP priority runs 0-9; the strict class gets the top */
+    pn_message_set_priority(message, (uint8_t)(cls->strict ? 9 :
+        (rank < 8 ? 8 - rank : 0)));
+
+    pn_data_t *properties = pn_message_properties(message);
+    pn_data_put_map(properties);
+    pn_data_enter(properties);
+    pn_data_put_string(properties, pn_bytes(strlen("MessageType"),
+        "MessageType"));
+    pn_data_put_string(properties, pn_bytes(strlen("BytesMessage"),
+        "BytesMessage"));
+    pn_data_put_string(properties, pn_bytes(strlen("PriorityClass"),
+        "PriorityClass"));
+    pn_data_put_string(properties, pn_bytes(strlen(cls->name), cls->name));
+    latencyStamp(properties);
+    pn_data_exit(properties);
+
+    pn_data_put_binary(pn_message_body(message), pn_bytes(cls->size, body));
+}
+
+
+static void priorityReport(priorityClass *classes, int count,
+                           long long elapsed)
+{
+    int c;
+    double seconds = elapsed / 1000000.0;
+
+    printf("CLASS        LANE     SENT  FAILED      MB/s  WAIT-P50  WAIT-P99  "
+        "WAIT-MAX   ACK-P50   ACK-P99 (ms)\n");
+    for (c = 0; c < count; c++)
+    {
+        priorityClass *cls = &classes[c];
+        char lane[16];
+        if (cls->strict)
+        {
+            SNPRINTF(lane, sizeof(lane), "strict");
+        }
+        else
+        {
+            SNPRINTF(lane, sizeof(lane), "w=%d", cls->weight);
+        }
+        printf("%-12s %-6s %7ld %7ld %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+            cls->name, lane, cls->sent, cls->failed,
+            (seconds > 0) ? (cls->accepted * (double)cls->size / 1048576.0 /
+                seconds) : 0.0,
+            histogramPercentile(cls->queueWait, 50.0) / 1000.0,
+            histogramPercentile(cls->queueWait, 99.0) / 1000.0,
+            cls->queueWait->max / 1000.0,
+            histogramPercentile(cls->total, 50.0) / 1000.0,
+            histogramPercentile(cls->total, 99.0) / 1000.0);
+    }
+    printf("Sent for %.3f s\n", seconds);
+}
+
+
+static void priorityFree(priorityClass *classes, int count)
+{
+    int c;
+
+    for (c = 0; c < count; c++)
+    {
+        free(classes[c].queueWait);
+        free(classes[c].total);
+        classes[c].queueWait = NULL;
+        classes[c].total = NULL;
+    }
+}
+#endif
+
+
+/*
+** Sends the workload in classes, putting each message when its class is
+** next in line and the pipeline has room for it, and reports the wait
+** and throughput of every class.
+*/
+int prioritySend(pn_messenger_t *messenger, pn_message_t *message,
+                 char *address, priorityClass *classes, int count)
+{
+#if (PN_VERSION_MINOR > 7)
+    priorityFlight flights[PRIORITY_WINDOW];
+    int inFlight = 0;
+    int weightedFlights = 0;
+    size_t weightedBytes = 0;
+    size_t largest = 1;
+    long remaining = 0;
+    int turn = 0;             /* weighted class whose round it is */
+    bool topped = false;      /* whether it has had its quantum this round */
+    int result = 0;
+    int c;
+    int i;
+    int err;
+
+    for (c = 0; c < count; c++)
+    {
+        classes[c].queueWait = (histogram *)malloc(sizeof(histogram));
+        classes[c].total = (histogram *)malloc(sizeof(histogram));
+        if ((NULL == classes[c].queueWait) || (NULL == classes[c].total))
+        {
+            printf("ERROR: cannot allocate priority class histograms\n");
+            priorityFree(classes, c + 1);
+            return -1;
+        }
+        histogramReset(classes[c].queueWait);
+        histogramReset(classes[c].total);
+        remaining += classes[c].count;
+        if (classes[c].size > largest)
+        {
+            largest = classes[c].size;
+        }
+    }
+    char *body = (char *)malloc(largest);
+    if (NULL == body)
+    {
+        printf("ERROR: cannot allocate a %lu byte body\n",
+            (unsigned long)largest);
+        priorityFree(classes, count);
+        return -1;
+    }
+    memset(body, 'x', largest);
+
+    long long start = currentMicros();
+    while (remaining > 0)
+    {
+        long long now = currentMicros();
+
+        for (c = 0; c < count; c++)
+        {
+            priorityClass *cls = &classes[c];
+            while ((cls->arrived < cls->count) &&
+                (arrivalTime(cls, cls->arrived, start) <= now))
+            {
+                cls->arrived++;
+            }
+        }
+
+        /* Fill the window: the strict class first, then weighted turns */
+        while (inFlight < PRIORITY_WINDOW)
+        {
+            priorityClass *next = NULL;
+            int chosen = -1;
+
+            for (c = 0; c < count; c++)
+            {
+                if (classes[c].strict && (classes[c].sent < classes[c].arrived))
+                {
+                    chosen = c;
+                    break;
+                }
+            }
+
+            /*
+            ** Deficit round robin. A class whose message is bigger than
+            ** its quantum builds up credit over several rounds, so keep
+            ** going round while any weighted class has something queued.
+            */
+            bool backlog = false;
+            for (c = 0; c < count; c++)
+            {
+                if (!classes[c].strict &&
+                    (classes[c].sent < classes[c].arrived))
+                {
+                    backlog = true;
+                }
+            }
+            while (backlog && (chosen < 0))
+            {
+                priorityClass *cls = &classes[turn];
+                if (!cls->strict && (cls->sent < cls->arrived))
+                {
+                    if (!topped)
+                    {
+                        cls->deficit += (long long)cls->weight *
+                            PRIORITY_QUANTUM;
+                        topped = true;
+                    }
+                    if ((long long)cls->size <= cls->deficit)
+                    {
+                        chosen = turn;
+                        break;
+                    }
+                }
+                else if (!cls->strict)
+                {
+                    /* An idle class does not save up credit */
+                    cls->deficit = 0;
+                }
+                turn = (turn + 1) % count;
+                topped = false;
+            }
+            if (chosen < 0)
+            {
+                break;
+            }
+
+            next = &classes[chosen];
+            if (!next->strict && (weightedBytes > 0) &&
+                (weightedBytes + next->size > PRIORITY_MAX_INFLIGHT))
+            {
+                /* Wait for bulk in flight to drain before adding more */
+                break;
+            }
+            if (!next->strict &&
+                (weightedFlights >= PRIORITY_WINDOW - PRIORITY_STRICT_SLOTS))
+            {
+                /* The rest of the window is kept for the strict class */
+                break;
+            }
+
+            setupPrioritized(message, address, next, chosen, body);
+            err = pn_messenger_put(messenger, message);
+            long long arrival = arrivalTime(next, next->sent, start);
+            next->sent++;
+            histogramRecord(next->queueWait, now - arrival);
+            if (!next->strict)
+            {
+                next->deficit -= (long long)next->size;
+            }
+            if (err != 0)
+            {
+                protonError(err, "pn_messenger_put", messenger);
+                next->failed++;
+                remaining--;
+                continue;
+            }
+            flights[inFlight].tracker =
+                pn_messenger_outgoing_tracker(messenger);
+            flights[inFlight].cls = chosen;
+            flights[inFlight].size = next->size;
+            flights[inFlight].arrival = arrival;
+            inFlight++;
+            if (!next->strict)
+            {
+                weightedBytes += next->size;
+                weightedFlights++;
+            }
+        }
+
+        err = pn_messenger_send(messenger, -1);
+        if ((err != 0) && (err != PN_INPROGRESS))
+        {
+            protonError(err, "pn_messenger_send", messenger);
+        }
+        /* Wake up in time for the next arrival */
+        int poll = PRIORITY_POLL;
+        for (c = 0; c < count; c++)
+        {
+            if (classes[c].arrived < classes[c].count)
+            {
+                long long wait = (arrivalTime(&classes[c], classes[c].arrived,
+                    start) - currentMicros()) / 1000;
+                if (wait < poll)
+                {
+                    poll = (wait > 0) ? (int)wait : 0;
+                }
+            }
+        }
+        err = pn_messenger_work(messenger, poll);
+        if ((err < 0) && (err != PN_TIMEOUT) && (err != PN_INPROGRESS))
+        {
+            protonError(err, "pn_messenger_work", messenger);
+            result = -1;
+            break;
+        }
+
+        /* Outcomes can arrive in any order, so check every delivery */
+        now = currentMicros();
+        for (i = 0; i < inFlight; )
+        {
+            pn_status_t status =
+                pn_messenger_status(messenger, flights[i].tracker);
+            if (!isFinalStatus(status))
+            {
+                i++;
+                continue;
+            }
+            priorityClass *cls = &classes[flights[i].cls];
+            if (PN_STATUS_ACCEPTED == status)
+            {
+                cls->accepted++;
+                histogramRecord(cls->total, now - flights[i].arrival);
+            }
+            else
+            {
+                cls->failed++;
+            }
+            if (!cls->strict)
+            {
+                weightedBytes -= flights[i].size;
+                weightedFlights--;
+            }
+            pn_messenger_settle(messenger, flights[i].tracker, 0);
+            flights[i] = flights[--inFlight];
+            remaining--;
+        }
+    }
+
+    priorityReport(classes, count, currentMicros() - start);
+    priorityFree(classes, count);
+    free(body);
+    return result;
+#else
+    /*
+    ** Scheduling around outcomes as they arrive needs nonblocking sends
+    ** and pn_messenger_work(), which are only usable from Proton-C 0.8 on.
+    */
+    printf("Priority classes require Proton-C 0.8 or later\n");
+    return -1;
+#endif
+}
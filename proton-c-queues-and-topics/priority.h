@@ -0,0 +1,79 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __PRIORITY_H
+#define __PRIORITY_H
+
+#include "proton/message.h"
+#include "proton/messenger.h"
+#include "histogram.h"
+
+/*
+** Priority classes for the sender's outgoing pipeline. Every class has
+** its own queue. The strict class, if there is one, is always served
+** first. The weighted classes share what is left by deficit round robin
+** over bytes, each getting weight * PRIORITY_QUANTUM bytes per round.
+**
+** Messenger sends everything for one entity over one link, so a message
+** cannot overtake one that has already been put. The scheduler therefore
+** caps the bytes of weighted messages in flight at
+** PRIORITY_MAX_INFLIGHT. The strict class ignores that cap, so an urgent
+** message waits behind at most PRIORITY_MAX_INFLIGHT bytes of bulk, not
+** behind the whole bulk queue. Weighted messages may also only take
+** PRIORITY_WINDOW - PRIORITY_STRICT_SLOTS of the deliveries in flight, so
+** that many small ones cannot leave the strict class without a slot.
+**
+** A workload is given as comma-separated class specifications:
+**
+**   name:weight:count:size[:rate]
+**
+** where weight is a number, or "strict" for the strict class. count
+** messages of size body bytes arrive at rate per second, or all at once
+** if rate is 0 or missing. For example:
+**
+**   control:strict:1000:64:100,bulk:1:200:196608,events:4:20000:512
+**
+** Sizes above 256 KB need a Premium tier namespace.
+*/
+#define PRIORITY_MAX_CLASSES	8
+#define PRIORITY_MAX_SIZE	(16 * 1024 * 1024)
+#define PRIORITY_QUANTUM	(64 * 1024)
+#define PRIORITY_MAX_INFLIGHT	(4 * 1024 * 1024)
+#define PRIORITY_WINDOW		256
+#define PRIORITY_STRICT_SLOTS	32
+
+typedef struct priorityClass
+{
+    char name[32];
+    bool strict;
+    int weight;
+    long count;
+    size_t size;
+    double rate;              /* arrivals per second, 0 is all at once */
+    long arrived;
+    long sent;                /* put so far; arrived - sent are queued */
+    long accepted;
+    long failed;
+    long long deficit;        /* bytes this class may still send this round */
+    histogram *queueWait;     /* arrival to put, microseconds */
+    histogram *total;         /* arrival to accepted, microseconds */
+} priorityClass;
+
+extern int priorityParse(const char *spec, priorityClass *classes, int max);
+extern int prioritySend(pn_messenger_t *messenger, pn_message_t *message,
+                        char *address, priorityClass *classes, int count);
+
+#endif /* __PRIORITY_H */
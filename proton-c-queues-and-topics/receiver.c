@@ -25,18 +25,132 @@
 #endif
 
 #include "common.h"
+#include "stream.h"
+#include "fairrecv.h"
+#include "latency.h"
+#include "trace.h"
+#include "filter.h"
+#include "partition.h"
 
 #define VERBOSE
 #define EXTRAVERBOSE
 
-int receive(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
+typedef struct receiverOptions
+{
+    char *streamPrefix;   /* -stream: write stream chunks to prefix.<id> */
+    char *entityList;     /* -entities: also receive from these entities */
+    bool reply;           /* -reply: answer requests that have a reply_to */
+    char *latencyFile;    /* -latency: track latency, export CSV here */
+    char *captureFile;    /* -capture: record received messages here */
+    char *filter;         /* -filter: only process matching messages */
+    bool rejectNoMatch;   /* -nomatch reject: reject rather than accept */
+    bool ordering;        /* -ordering: check per-partition-key order */
+    char *url;            /* -url: receive from here, not Service Bus */
+} receiverOptions;
+
+
+/*
+** Answers a request from "sender -rpc" by sending a message carrying the
+** request's correlation id to the entity named in its reply_to.
+*/
+void sendReply(pn_messenger_t *messenger, pn_message_t *request,
+               pn_message_t *reply, char *sbnamespace, char *issuerName,
+               char *issuerKey)
 {
     char address[500];
-    SNPRINTF(address, sizeof address,
+    const char *replyTo = pn_message_get_reply_to(request);
+
+    if (NULL == replyTo)
+    {
+        return;
+    }
+    SNPRINTF(address, sizeof(address),
         "amqps://%s:%s@%s." SERVICEBUS_DOMAIN "/%s",
-        issuerName, issuerKey, sbnamespace, entity);
+        issuerName, issuerKey, sbnamespace, replyTo);
+
+    pn_message_clear(reply);
+    pn_message_set_address(reply, address);
+    pn_message_set_correlation_id(reply,
+        pn_message_get_correlation_id(request));
+    pn_message_set_subject(reply, "Reply");
+    pn_data_put_string(pn_message_body(reply),
+        pn_bytes(strlen("Reply"), "Reply"));
+
+    int err = pn_messenger_put(messenger, reply);
+    protonError(err, "pn_messenger_put", messenger);
+#if (PN_VERSION_MINOR == 4)
+    err = pn_messenger_send(messenger);
+#else
+    err = pn_messenger_send(messenger, -1);
+#endif
+    protonError(err, "pn_messenger_send", messenger);
+}
+
+int receive(char *sbnamespace, char *entity, char *issuerName, char *issuerKey,
+            receiverOptions *options)
+{
+    /*
+    ** In stream mode up to STREAM_WINDOW chunks are requested at a time,
+    ** which bounds how much message data is held in memory at once.
+    */
+    int credit = (options->streamPrefix != NULL) ? STREAM_WINDOW : 1;
+    fileSinkContext sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.prefix = options->streamPrefix;
+
+    latencyTracker *latency = NULL;
+    if (options->latencyFile != NULL)
+    {
+        latency = latencyCreate(options->latencyFile);
+    }
+
+    /*
+    ** The filter is compiled once up front; per message it only reads the
+    ** properties and headers it names, so a message that does not match
+    ** is settled without its body ever being formatted or printed.
+    */
+    filter *match = NULL;
+    long filtered = 0;
+    if (options->filter != NULL)
+    {
+        match = filterCompile(options->filter);
+        if (NULL == match)
+        {
+            return -1;
+        }
+    }
+
+    orderTracker *order = NULL;
+    if (options->ordering)
+    {
+        order = orderCreate();
+    }
+
+    traceWriter *capture = NULL;
+    if (options->captureFile != NULL)
+    {
+        capture = traceCreate(options->captureFile);
+        if (NULL == capture)
+        {
+            filterFree(match);
+            return -1;
+        }
+    }
+
+    char address[500];
+    if (options->url != NULL)
+    {
+        SNPRINTF(address, sizeof address, "%s/%s", options->url, entity);
+    }
+    else
+    {
+        SNPRINTF(address, sizeof address,
+            "amqps://%s:%s@%s." SERVICEBUS_DOMAIN "/%s",
+            issuerName, issuerKey, sbnamespace, entity);
+    }
 
     pn_message_t *message = pn_message();
+    pn_message_t *reply = pn_message();
 
     printf("CALL pn_messenger... ");
     pn_messenger_t *messenger = pn_messenger(NULL);
@@ -106,7 +220,8 @@ int receive(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
     ** PN_ACCEPT_MODE_AUTO, with the important difference that the auto
     ** accept will not occur until the next call to _get().
     ** This sample does explicit accepts, so the incoming window size doesn't
-    ** really matter.
+    ** really matter, as long as it covers every message received in one
+    ** call to pn_messenger_recv().
     **
     ** IMPORTANT: Setting the incoming window to nonzero changes Proton-C's
     ** messaging mode to one in which it requests that the broker retain
@@ -114,7 +229,7 @@ int receive(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
     ** reliable messaging!
     */
     printf("CALL pn_messenger_set_incoming_window... ");
-    err = pn_messenger_set_incoming_window(messenger, 1);
+    err = pn_messenger_set_incoming_window(messenger, credit);
     printf("RETURNED %d\n", err);
     protonError(err, "pn_messenger_set_incoming_window", messenger);
     if (err != 0)
@@ -146,9 +261,13 @@ int receive(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
     while (true)
     {
         printf("CALL pn_messenger_recv... ");
-        err = pn_messenger_recv(messenger, 1);
+        err = pn_messenger_recv(messenger, credit);
         printf("RETURNED %d\n", err);
         protonError(err, "pn_messenger_recv", messenger);
+        if (latency != NULL)
+        {
+            latencyTick(latency, false);
+        }
         if (PN_TIMEOUT == err)
         {
             printf("Timeout, breaking out of the receive loop\n");
@@ -169,6 +288,60 @@ int receive(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
                 protonError(err, "pn_messenger_get", messenger);
                 pn_tracker_t tracker = pn_messenger_incoming_tracker(messenger);
 
+                if ((match != NULL) && !filterMatch(match, message))
+                {
+                    filtered++;
+                    if (options->rejectNoMatch)
+                    {
+                        err = pn_messenger_reject(messenger, tracker, 0);
+                        protonError(err, "pn_messenger_reject", messenger);
+                    }
+                    else
+                    {
+                        err = pn_messenger_accept(messenger, tracker, 0);
+                        protonError(err, "pn_messenger_accept", messenger);
+                    }
+                    continue;
+                }
+
+                if (latency != NULL)
+                {
+                    latencyRecord(latency, message);
+                }
+                if (order != NULL)
+                {
+                    orderRecord(order, message);
+                }
+                if (capture != NULL)
+                {
+                    traceWrite(capture, message);
+                }
+
+                if (options->streamPrefix != NULL)
+                {
+                    int consumed = streamReceiveChunk(message, fileSink, &sink);
+                    if (consumed > 0)
+                    {
+                        err = pn_messenger_accept(messenger, tracker, 0);
+                        protonError(err, "pn_messenger_accept", messenger);
+                        continue;
+                    }
+                    else if (consumed < 0)
+                    {
+                        printf("CALL pn_messenger_reject... ");
+                        err = pn_messenger_reject(messenger, tracker, 0);
+                        printf("RETURNED %d\n", err);
+                        protonError(err, "pn_messenger_reject", messenger);
+                        continue;
+                    }
+                }
+
+                if (options->reply)
+                {
+                    sendReply(messenger, message, reply, sbnamespace,
+                        issuerName, issuerKey);
+                }
+
 #ifdef VERBOSE
                 printf("########## Begin message ############\n");
                 printf("Address: %s\n", pn_message_get_address(message));
@@ -218,8 +391,15 @@ int receive(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
                 pn_data_t *body = pn_message_body(message);
                 char buffer[1024];
                 size_t buffsize = sizeof(buffer);
-                pn_data_format(body, buffer, &buffsize);
-                printf("Content: %s\n", buffer);
+                if (PN_OVERFLOW == pn_data_format(body, buffer, &buffsize))
+                {
+                    printf("Content: (more than %lu bytes, not shown)\n",
+                        (unsigned long)sizeof(buffer));
+                }
+                else
+                {
+                    printf("Content: %s\n", buffer);
+                }
 
                 pn_data_t *properties = pn_message_properties(message);
 #ifdef EXTRAVERBOSE
@@ -247,6 +427,25 @@ int receive(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
     pn_messenger_free(messenger);
 
     pn_message_free(message);
+    pn_message_free(reply);
+    fileSinkClose(&sink);
+    if (latency != NULL)
+    {
+        latencyTick(latency, true);
+        latencyFree(latency);
+    }
+    traceClose(capture);
+    if (order != NULL)
+    {
+        orderReport(order);
+        orderFree(order);
+    }
+    if (match != NULL)
+    {
+        printf("%ld messages did not match the filter and were %s\n",
+            filtered, options->rejectNoMatch ? "rejected" : "accepted");
+        filterFree(match);
+    }
 
     return 0;
 }
@@ -254,9 +453,104 @@ int receive(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
 
 int main(int argc, char **argv)
 {
-    if (argc != 5)
+    receiverOptions options;
+    int i;
+
+    memset(&options, 0, sizeof(options));
+
+    for (i = 5; i < argc; i++)
+    {
+        if ((0 == strcmp(argv[i], "-stream")) && (i + 1 < argc))
+        {
+            options.streamPrefix = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-entities")) && (i + 1 < argc))
+        {
+            options.entityList = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-reply"))
+        {
+            options.reply = true;
+        }
+        else if ((0 == strcmp(argv[i], "-latency")) && (i + 1 < argc))
+        {
+            options.latencyFile = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-capture")) && (i + 1 < argc))
+        {
+            options.captureFile = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-ordering"))
+        {
+            options.ordering = true;
+        }
+        else if ((0 == strcmp(argv[i], "-url")) && (i + 1 < argc))
+        {
+            options.url = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-filter")) && (i + 1 < argc))
+        {
+            options.filter = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-nomatch")) && (i + 1 < argc) &&
+            ((0 == strcmp(argv[i + 1], "accept")) ||
+             (0 == strcmp(argv[i + 1], "reject"))))
+        {
+            options.rejectNoMatch = (0 == strcmp(argv[++i], "reject"));
+        }
+        else
+        {
+            argc = 0; /* force the usage message */
+            break;
+        }
+    }
+
+    /* Fair receiving has its own loop, which does none of the rest */
+    if ((options.entityList != NULL) && ((options.streamPrefix != NULL) ||
+        options.reply || (options.latencyFile != NULL) ||
+        (options.captureFile != NULL) || (options.filter != NULL) ||
+        options.rejectNoMatch || options.ordering || (options.url != NULL)))
     {
-        printf("Usage: %s namespace entity issuer-name issuer-key\n", argv[0]);
+        printf("-entities cannot be combined with -stream, -reply, "
+            "-latency, -capture,\n-filter, -nomatch, -ordering or -url\n");
+        argc = 0;
+    }
+
+    if (argc < 5)
+    {
+        printf("Usage: %s namespace entity issuer-name issuer-key "
+            "[options]\n", argv[0]);
+        printf("  -stream prefix  write streamed chunks to prefix.<stream-id>"
+            "\n");
+        printf("  -entities file  receive from every entity listed in file "
+            "as well, one\n"
+            "                  \"path [weight]\" per line, over one "
+            "connection\n");
+        printf("  -reply          answer each message that has a reply_to, "
+            "for use\n"
+            "                  with \"sender -rpc\"\n");
+        printf("  -latency file   report send-to-receive latency "
+            "percentiles and append\n"
+            "                  them to file as CSV (\"-\" to only "
+            "print them)\n");
+        printf("  -capture file   record every received message to a trace "
+            "file for\n"
+            "                  \"sender -replay\"\n");
+        printf("  -filter expr    only process messages matching a SQL-like "
+            "expression over\n"
+            "                  properties and sys.* headers, e.g. "
+            "\"MessageType = 'TextMessage'\"\n");
+        printf("  -nomatch accept|reject\n"
+            "                  settle messages that do not match the filter "
+            "this way\n"
+            "                  (default accept, which drops them)\n");
+        printf("  -ordering       check that messages of each partition key "
+            "arrive in\n"
+            "                  \"sender -partitions\" order\n");
+        printf("  -url base       receive from base/entity instead of "
+            "Service Bus, for\n"
+            "                  example amqp://~127.0.0.1:5673 to listen "
+            "locally\n");
         return 1;
     }
 
@@ -267,6 +561,39 @@ int main(int argc, char **argv)
 #else
     char *key = argv[4];
 #endif
-    receive(argv[1], argv[2], argv[3], key);
+    if (options.entityList != NULL)
+    {
+        fairLink *links = (fairLink *)calloc(FAIR_MAX_LINKS, sizeof(fairLink));
+        int count = 0;
+        if (NULL == links)
+        {
+            printf("ERROR: cannot allocate %d links\n", FAIR_MAX_LINKS);
+#if (PN_VERSION_MINOR >= 7)
+            free(key);
+#endif
+            return 1;
+        }
+        if (strcmp(argv[2], "-") != 0)
+        {
+            SNPRINTF(links[0].path, sizeof(links[0].path), "%s", argv[2]);
+            links[0].weight = 1;
+            count = 1;
+        }
+        count = fairLoadEntities(options.entityList, links, count,
+            FAIR_MAX_LINKS);
+        if (count > 0)
+        {
+            fairReceive(argv[1], argv[3], key, links, count);
+        }
+        free(links);
+    }
+    else
+    {
+        receive(argv[1], argv[2], argv[3], key, &options);
+    }
+
+#if (PN_VERSION_MINOR >= 7)
+    free(key);
+#endif
     return 0;
 }
@@ -0,0 +1,368 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proton/message.h"
+#include "proton/messenger.h"
+#include "proton/error.h"
+#ifndef PN_VERSION_MAJOR
+#include "proton/version.h"
+#endif
+
+#include "common.h"
+#include "histogram.h"
+#include "rpc.h"
+
+/* How long one pass of the client loop waits for network activity */
+#define RPC_POLL	10
+
+
+/*
+** Correlation ids are random UUIDs, so any eight of their bytes already
+** make a good hash; the multiply just spreads them over the low bits.
+*/
+static size_t rpcHash(pn_uuid_t *id)
+{
+    unsigned long long h;
+    memcpy(&h, id->bytes, sizeof(h));
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return (size_t)(h ^ (h >> 32));
+}
+
+
+int rpcTableInit(rpcTable *table, size_t maxEntries)
+{
+    size_t capacity = 16;
+    while (capacity < 2 * maxEntries)
+    {
+        capacity <<= 1;
+    }
+    table->entries = (rpcEntry *)calloc(capacity, sizeof(rpcEntry));
+    if (NULL == table->entries)
+    {
+        return -1;
+    }
+    table->mask = capacity - 1;
+    table->count = 0;
+    return 0;
+}
+
+
+void rpcTableFree(rpcTable *table)
+{
+    free(table->entries);
+    table->entries = NULL;
+}
+
+
+rpcEntry *rpcTableInsert(rpcTable *table, pn_uuid_t *id)
+{
+    size_t i = rpcHash(id) & table->mask;
+
+    if (table->count * 2 > table->mask)
+    {
+        return NULL; /* more than half full, caller must wait */
+    }
+    while (table->entries[i].used)
+    {
+        i = (i + 1) & table->mask;
+    }
+    memcpy(&table->entries[i].id, id, sizeof(pn_uuid_t));
+    table->entries[i].used = true;
+    table->count++;
+    return &table->entries[i];
+}
+
+
+rpcEntry *rpcTableFind(rpcTable *table, pn_uuid_t *id)
+{
+    size_t i = rpcHash(id) & table->mask;
+
+    while (table->entries[i].used)
+    {
+        if (0 == memcmp(&table->entries[i].id, id, sizeof(pn_uuid_t)))
+        {
+            return &table->entries[i];
+        }
+        i = (i + 1) & table->mask;
+    }
+    return NULL;
+}
+
+
+/*
+** Backward-shift deletion: pull later members of the probe run into the
+** hole whenever their home slot is not between the hole and themselves.
+*/
+void rpcTableRemove(rpcTable *table, rpcEntry *entry)
+{
+    size_t hole = (size_t)(entry - table->entries);
+    size_t i = hole;
+
+    for (;;)
+    {
+        i = (i + 1) & table->mask;
+        if (!table->entries[i].used)
+        {
+            break;
+        }
+        size_t home = rpcHash(&table->entries[i].id) & table->mask;
+        if (((i - home) & table->mask) >= ((i - hole) & table->mask))
+        {
+            table->entries[hole] = table->entries[i];
+            hole = i;
+        }
+    }
+    table->entries[hole].used = false;
+    table->count--;
+}
+
+
+/*
+** Appends a deadline to the ring, doubling the ring when it is full.
+*/
+int rpcDeadlinesPush(rpcDeadlines *ring, pn_uuid_t *id, long long deadline)
+{
+    if (ring->size == ring->capacity)
+    {
+        size_t capacity = 2 * ring->capacity;
+        pn_uuid_t *ids = (pn_uuid_t *)malloc(capacity * sizeof(pn_uuid_t));
+        long long *deadlines =
+            (long long *)malloc(capacity * sizeof(long long));
+        size_t i;
+        if ((NULL == ids) || (NULL == deadlines))
+        {
+            free(ids);
+            free(deadlines);
+            return -1;
+        }
+        for (i = 0; i < ring->size; i++)
+        {
+            size_t from = (ring->head + i) % ring->capacity;
+            ids[i] = ring->ids[from];
+            deadlines[i] = ring->deadlines[from];
+        }
+        free(ring->ids);
+        free(ring->deadlines);
+        ring->ids = ids;
+        ring->deadlines = deadlines;
+        ring->capacity = capacity;
+        ring->head = 0;
+    }
+    size_t tail = (ring->head + ring->size) % ring->capacity;
+    ring->ids[tail] = *id;
+    ring->deadlines[tail] = deadline;
+    ring->size++;
+    return 0;
+}
+
+
+#if (PN_VERSION_MINOR > 7)
+static void setupRequest(pn_message_t *message, char *address, char *replyTo,
+                         pn_uuid_t *id, long sequence)
+{
+    char text[64];
+    pn_atom_t atom;
+
+    pn_message_clear(message);
+    pn_message_set_address(message, address);
+    pn_message_set_reply_to(message, replyTo);
+
+    generateUuid(id);
+    atom.type = PN_UUID;
+    atom.u.as_uuid = *id;
+    pn_message_set_id(message, atom);
+    pn_message_set_correlation_id(message, atom);
+
+    pn_message_set_subject(message, "Request");
+    SNPRINTF(text, sizeof(text), "Request %ld", sequence);
+    pn_data_put_string(pn_message_body(message), pn_bytes(strlen(text), text));
+}
+#endif
+
+
+int rpcClient(pn_messenger_t *messenger, pn_message_t *message,
+              char *address, char *replyAddress, char *replyTo,
+              long count, int outstanding, int timeout)
+{
+#if (PN_VERSION_MINOR > 7)
+    rpcTable table;
+    rpcDeadlines deadlines;
+    histogram *latency = (histogram *)malloc(sizeof(histogram));
+    long issued = 0;
+    long answered = 0;
+    long expired = 0;
+    long stray = 0;
+    int err;
+
+    if ((NULL == latency) || (rpcTableInit(&table, outstanding) != 0))
+    {
+        printf("ERROR: cannot allocate tables for %d requests\n", outstanding);
+        free(latency);
+        return -1;
+    }
+    histogramReset(latency);
+    /* A starting size; the ring grows if replies are lost, see rpc.h */
+    deadlines.capacity = 2 * (size_t)outstanding;
+    deadlines.ids = (pn_uuid_t *)malloc(deadlines.capacity * sizeof(pn_uuid_t));
+    deadlines.deadlines =
+        (long long *)malloc(deadlines.capacity * sizeof(long long));
+    deadlines.head = 0;
+    deadlines.size = 0;
+
+    printf("CALL pn_messenger_subscribe... ");
+    pn_subscription_t *subscription =
+        pn_messenger_subscribe(messenger, replyAddress);
+    printf("RETURNED\n");
+    if ((NULL == subscription) || (NULL == deadlines.ids) ||
+        (NULL == deadlines.deadlines))
+    {
+        protonError(PN_ERR, "pn_messenger_subscribe", messenger);
+        free(deadlines.ids);
+        free(deadlines.deadlines);
+        rpcTableFree(&table);
+        free(latency);
+        return -1;
+    }
+
+    printf("Sending %ld requests with up to %d outstanding, replies to %s\n",
+        count, outstanding, replyTo);
+    long long start = currentMicros();
+
+    /*
+    ** Replies are received presettled (ReceiveAndDelete): a lost reply
+    ** shows up as a timeout anyway, and it saves a disposition per reply.
+    ** Credit is kept topped up automatically by receiving with -1.
+    */
+    err = pn_messenger_recv(messenger, -1);
+    if ((err != 0) && (err != PN_INPROGRESS))
+    {
+        protonError(err, "pn_messenger_recv", messenger);
+    }
+
+    while ((answered + expired) < count)
+    {
+        long long now = currentMicros();
+
+        while ((issued < count) && ((long)table.count < outstanding))
+        {
+            pn_uuid_t id;
+            setupRequest(message, address, replyTo, &id, issued);
+            err = pn_messenger_put(messenger, message);
+            if (err != 0)
+            {
+                protonError(err, "pn_messenger_put", messenger);
+                break;
+            }
+            rpcEntry *entry = rpcTableInsert(&table, &id);
+            if (NULL == entry)
+            {
+                break;
+            }
+            entry->sent = now;
+            entry->deadline = now + (long long)timeout * 1000;
+            issued++;
+            if (rpcDeadlinesPush(&deadlines, &id, entry->deadline) != 0)
+            {
+                /* Without a deadline it could never time out, so drop it */
+                printf("ERROR: cannot grow the deadline ring\n");
+                rpcTableRemove(&table, entry);
+                expired++;
+                break;
+            }
+        }
+
+        err = pn_messenger_send(messenger, -1);
+        if ((err != 0) && (err != PN_INPROGRESS))
+        {
+            protonError(err, "pn_messenger_send", messenger);
+        }
+        err = pn_messenger_work(messenger, RPC_POLL);
+        if ((err < 0) && (err != PN_TIMEOUT) && (err != PN_INPROGRESS))
+        {
+            protonError(err, "pn_messenger_work", messenger);
+            break;
+        }
+
+        now = currentMicros();
+        while (pn_messenger_incoming(messenger))
+        {
+            err = pn_messenger_get(messenger, message);
+            if (err != 0)
+            {
+                protonError(err, "pn_messenger_get", messenger);
+                continue;
+            }
+            pn_atom_t correlation = pn_message_get_correlation_id(message);
+            rpcEntry *entry = (PN_UUID == correlation.type) ?
+                rpcTableFind(&table, &correlation.u.as_uuid) : NULL;
+            if (NULL == entry)
+            {
+                /* Late reply to an expired request, or not ours at all */
+                stray++;
+                continue;
+            }
+            histogramRecord(latency, now - entry->sent);
+            rpcTableRemove(&table, entry);
+            answered++;
+        }
+
+        /*
+        ** Retire the head of the ring while it is either answered or past
+        ** its deadline; the first live, unexpired entry stops the scan.
+        */
+        while (deadlines.size > 0)
+        {
+            pn_uuid_t *id = &deadlines.ids[deadlines.head];
+            rpcEntry *entry = rpcTableFind(&table, id);
+            if (entry != NULL)
+            {
+                if (deadlines.deadlines[deadlines.head] > now)
+                {
+                    break;
+                }
+                rpcTableRemove(&table, entry);
+                expired++;
+            }
+            deadlines.head = (deadlines.head + 1) % deadlines.capacity;
+            deadlines.size--;
+        }
+    }
+
+    long long elapsed = currentMicros() - start;
+    printf("RPC %ld requests in %.3f s (%.1f/s): %ld answered, %ld timed out, "
+        "%ld stray replies\n", count, elapsed / 1000000.0,
+        (elapsed > 0) ? (count * 1000000.0 / elapsed) : 0.0,
+        answered, expired, stray);
+    histogramPrint(latency, "RPC latency us");
+
+    free(deadlines.ids);
+    free(deadlines.deadlines);
+    rpcTableFree(&table);
+    free(latency);
+    return (0 == expired) ? 0 : -1;
+#else
+    /*
+    ** The client loop relies on nonblocking sends and pn_messenger_work(),
+    ** which are only usable in this way from Proton-C 0.8 on.
+    */
+    printf("RPC mode requires Proton-C 0.8 or later\n");
+    return -1;
+#endif
+}
@@ -0,0 +1,77 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __RPC_H
+#define __RPC_H
+
+#include "proton/message.h"
+#include "proton/messenger.h"
+
+/*
+** Outstanding requests are kept in an open-addressing hash table keyed by
+** the 16-byte correlation id, using linear probing with backward-shift
+** deletion so that there are no tombstones to clean up. The table is
+** sized to a power of two at least twice the maximum number of
+** outstanding requests, which keeps probe sequences short.
+*/
+typedef struct rpcEntry
+{
+    pn_uuid_t id;
+    long long sent;       /* currentMicros() when the request was put */
+    long long deadline;
+    bool used;
+} rpcEntry;
+
+typedef struct rpcTable
+{
+    rpcEntry *entries;
+    size_t mask;          /* capacity - 1 */
+    size_t count;
+} rpcTable;
+
+/*
+** Every request gets the same timeout, so deadlines expire in the order
+** the requests were sent and a ring of ids is enough to find them.
+** Answered requests leave the ring only when they reach its head, so one
+** lost reply there holds up the entries behind it until it expires. The
+** ring therefore grows as needed rather than limiting new requests.
+*/
+typedef struct rpcDeadlines
+{
+    pn_uuid_t *ids;
+    long long *deadlines;
+    size_t capacity;
+    size_t head;
+    size_t size;
+} rpcDeadlines;
+
+#define RPC_DEFAULT_OUTSTANDING	1000
+#define RPC_MAX_OUTSTANDING	1000000
+#define RPC_DEFAULT_TIMEOUT	30000	/* milliseconds */
+
+extern int rpcTableInit(rpcTable *table, size_t maxEntries);
+extern void rpcTableFree(rpcTable *table);
+extern rpcEntry *rpcTableInsert(rpcTable *table, pn_uuid_t *id);
+extern rpcEntry *rpcTableFind(rpcTable *table, pn_uuid_t *id);
+extern void rpcTableRemove(rpcTable *table, rpcEntry *entry);
+extern int rpcDeadlinesPush(rpcDeadlines *ring, pn_uuid_t *id,
+                            long long deadline);
+
+extern int rpcClient(pn_messenger_t *messenger, pn_message_t *message,
+                     char *address, char *replyAddress, char *replyTo,
+                     long count, int outstanding, int timeout);
+
+#endif /* __RPC_H */
@@ -25,10 +25,85 @@
 #endif
 
 #include "common.h"
+#include "stream.h"
+#include "pacing.h"
+#include "rpc.h"
+#include "latency.h"
+#include "trace.h"
+#include "sidecar.h"
+#include "timerwheel.h"
+#include "outbox.h"
+#include "partition.h"
+#include "priority.h"
+#include "histogram.h"
 
 /* Comment out to use nonblocking send */
 #define USE_BLOCKING_SEND
 
+/* Messages in flight at once when sending with -count */
+#define BULK_WINDOW	64
+
+/* Encode buffer for -delay and -outbox, and how long a due message waits */
+#define ENCODE_BUFFER_SIZE	4096
+#define SCHEDULE_FLUSH_MS	1
+
+/*
+** Outbox wait once nothing is left to spool, how long a window may go
+** without an outcome before the broker counts as unavailable, and retry
+** backoff (ms)
+*/
+#define OUTBOX_IDLE_WAIT	100
+#define OUTBOX_STALL_TIMEOUT	5000
+#define OUTBOX_MIN_BACKOFF	100
+#define OUTBOX_MAX_BACKOFF	10000
+
+typedef struct senderOptions
+{
+    char *streamFile;     /* -stream: send this file ("-" is stdin) */
+    size_t chunkSize;     /* -chunk: stream chunk size in bytes */
+    long count;           /* -count: send this many text messages */
+    double rate;          /* -rate: messages per second, 0 is unpaced */
+    double burst;         /* -burst: messages allowed above the rate */
+    long rpcCount;        /* -rpc: send this many requests and await replies */
+    char *replyTo;        /* -replyto: entity the replies are sent to */
+    int outstanding;      /* -outstanding: requests awaiting a reply at once */
+    int timeout;          /* -timeout: milliseconds to wait for a reply */
+    char *replayFile;     /* -replay: send the messages in this trace */
+    double speed;         /* -speed: replay speed multiplier, 0 is maximum */
+    char *daemonSocket;   /* -daemon: forward messages from this socket */
+    long delay;           /* -delay: milliseconds to hold each message */
+    long spread;          /* -spread: spread due times over this many ms */
+    bool scheduled;       /* -scheduled: let the broker hold them instead */
+    char *outboxDir;      /* -outbox: spool messages through this directory */
+    int partitions;       /* -partitions: route -count messages by key */
+    int keys;             /* -keys: distinct partition keys */
+    bool sessions;        /* -sessions: use each key as the SessionId too */
+    int priorityCount;    /* -priority: number of classes in the workload */
+    priorityClass priorities[PRIORITY_MAX_CLASSES];
+    char *url;            /* -url: send here instead of to Service Bus */
+} senderOptions;
+
+/* A message held by sendScheduled() until it is due */
+typedef struct heldMessage
+{
+    long long due;
+    size_t size;
+    char bytes[1];
+} heldMessage;
+
+/* The outbox records put by sendOutbox() and not yet retired */
+typedef struct outboxWindow
+{
+    pn_tracker_t trackers[BULK_WINDOW];
+    bool corrupt[BULK_WINDOW];  /* undecodable, never put */
+    int count;                  /* records taken from the outbox */
+    int done;                   /* records committed, in order */
+    bool failed;                /* a put failed, so the window is short */
+    bool hasTracker;            /* last holds a tracker to settle */
+    pn_tracker_t last;
+    long long progress;         /* currentMicros() of the last outcome */
+} outboxWindow;
+
 void checkTracking(pn_messenger_t *messenger, pn_tracker_t tracker)
 {
     pn_status_t status = PN_STATUS_UNKNOWN;
@@ -211,8 +286,13 @@ void setupMessage(pn_message_t *message, char *messageType, char *address,
     pn_timestamp_t SEND_PROP_SOME_TIME = 1356998400000ULL;
     pn_data_put_timestamp(header, SEND_PROP_SOME_TIME);
 
+    /* For measuring end-to-end latency in the receiver, see latency.h */
+    latencyStamp(header);
+
     pn_data_exit(header);
 
+    pn_message_set_creation_time(message, currentTime());
+
     pn_message_set_content_type(message, "TestContentType");
 
     pn_atom_t correlation_id;
@@ -244,61 +324,14 @@ void setupMessage(pn_message_t *message, char *messageType, char *address,
 }
 
 
-int sender(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
+/*
+** Queues one message, sends it, and reports its final status.
+*/
+int sendMessage(pn_messenger_t *messenger, pn_message_t *message,
+                char *description, pn_uuid_t *id)
 {
-    char address[500];
-    SNPRINTF(address, sizeof(address),
-        "amqps://%s:%s@%s." SERVICEBUS_DOMAIN "/%s",
-        issuerName, issuerKey, sbnamespace, entity);
-
-    printf("Sending messages to %s\n", address);
-
-    pn_messenger_t *messenger = pn_messenger(NULL);
-
-    printf("CALL pn_messenger_set_outgoing_window... ");
-    /*
-    ** 5 is an arbitrary number here. It is not really necessary
-    ** with blocking send, but if you are not using blocking send
-    ** it determines how many outgoing messages you can track the
-    ** status of.
-    */
-    int err = pn_messenger_set_outgoing_window(messenger, 5);
-    printf("RETURNED %d\n", err);
-    if (err != 0)
-    {
-        protonError(err, "pn_messenger_set_outgoing_window", messenger);
-        return -1;
-    }
-
-#if (PN_VERSION_MINOR > 4) && defined(USE_BLOCKING_SEND)
-    printf("CALL pn_messenger_set_blocking... ");
-    err = pn_messenger_set_blocking(messenger, true);
-    printf("RETURNED %d\n", err);
-    if (err != 0)
-    {
-        protonError(err, "pn_messenger_set_blocking", messenger);
-        return -1;
-    }
-#endif
-
-    printf("CALL pn_messenger_start... ");
-    err = pn_messenger_start(messenger);
-    printf("RETURNED %d\n", err);
-    if (err != 0)
-    {
-        protonError(err, "pn_messenger_start", messenger);
-        return -1;
-    }
-
-    pn_message_t *message = pn_message();
-
-    pn_uuid_t id;
-    setupMessage(message, "TextMessage", address, &id);
-    pn_data_t *body = pn_message_body(message);
-    char textBody[] = "This is a text message";
-    pn_data_put_string(body, pn_bytes(strlen(textBody), textBody));
     printf("CALL pn_messenger_put... ");
-    err = pn_messenger_put(messenger, message);
+    int err = pn_messenger_put(messenger, message);
     printf("RETURNED %d\n", err);
     if (err != 0)
     {
@@ -323,8 +356,8 @@ int sender(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
     printf("RETURNED %d\n", err);
     if (0 == err)
     {
-        printf("Sent TextMessage with id\n");
-        outputUuid(&id);
+        printf("Sent %s with id\n", description);
+        outputUuid(id);
     }
     else
     {
@@ -333,45 +366,29 @@ int sender(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
     pn_tracker_t tracker = pn_messenger_outgoing_tracker(messenger);
     checkTracking(messenger, tracker);
 
+    return err;
+}
+
+
+/*
+** Sends the fixed set of four messages which demonstrate different
+** formats for the body contents.
+*/
+void sendSamples(pn_messenger_t *messenger, pn_message_t *message,
+                 char *address)
+{
+    pn_uuid_t id;
+    setupMessage(message, "TextMessage", address, &id);
+    pn_data_t *body = pn_message_body(message);
+    char textBody[] = "This is a text message";
+    pn_data_put_string(body, pn_bytes(strlen(textBody), textBody));
+    sendMessage(messenger, message, "TextMessage", &id);
+
     setupMessage(message, "BytesMessage", address, &id);
     body = pn_message_body(message);
     char bytesBody[] = "This is a bytes message";
     pn_data_put_binary(body, pn_bytes(strlen(bytesBody), bytesBody));
-    printf("CALL pn_messenger_put... ");
-    err = pn_messenger_put(messenger, message);
-    printf("RETURNED %d\n", err);
-    if (err != 0)
-    {
-        protonError(err, "pn_messenger_put", messenger);
-    }
-    printf("CALL pn_messenger_send... ");
-#if (PN_VERSION_MINOR == 4)
-    /*
-    ** Proton-C 0.4: pn_messenger_send() always sends all messages which
-    ** have been queued for send by pn_messenger_put().
-    */
-    err = pn_messenger_send(messenger);
-#else
-    /*
-    ** Proton-C 0.5 and later: pn_messenger_send() takes a specific number
-    ** of messages to send, which can also be used to specify blocking or
-    ** nonblocking. This sample uses -1 which blocks until all outgoing
-    ** messages have been sent.
-    */
-    err = pn_messenger_send(messenger, -1);
-#endif
-    printf("RETURNED %d\n", err);
-    if (0 == err)
-    {
-        printf("Sent BytesMessage with id\n");
-        outputUuid(&id);
-    }
-    else
-    {
-        protonError(err, "pn_messenger_send", messenger);
-    }
-    tracker = pn_messenger_outgoing_tracker(messenger);
-    checkTracking(messenger, tracker);
+    sendMessage(messenger, message, "BytesMessage", &id);
 
     setupMessage(message, "MapMessage", address, &id);
     body = pn_message_body(message);
@@ -382,41 +399,7 @@ int sender(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
     pn_data_put_string(body, pn_bytes(strlen("key1"), "key1"));
     pn_data_put_string(body, pn_bytes(strlen("value1"), "value1"));
     pn_data_exit(body);
-    printf("CALL pn_messenger_put... ");
-    err = pn_messenger_put(messenger, message);
-    printf("RETURNED %d\n", err);
-    if (err != 0)
-    {
-        protonError(err, "pn_messenger_put", messenger);
-    }
-    printf("CALL pn_messenger_send... ");
-#if (PN_VERSION_MINOR == 4)
-    /*
-    ** Proton-C 0.4: pn_messenger_send() always sends all messages which
-    ** have been queued for send by pn_messenger_put().
-    */
-    err = pn_messenger_send(messenger);
-#else
-    /*
-    ** Proton-C 0.5 and later: pn_messenger_send() takes a specific number
-    ** of messages to send, which can also be used to specify blocking or
-    ** nonblocking. This sample uses -1 which blocks until all outgoing
-    ** messages have been sent.
-    */
-    err = pn_messenger_send(messenger, -1);
-#endif
-    printf("RETURNED %d\n", err);
-    if (0 == err)
-    {
-        printf("Sent MapMessage with id\n");
-        outputUuid(&id);
-    }
-    else
-    {
-        protonError(err, "pn_messenger_send", messenger);
-    }
-    tracker = pn_messenger_outgoing_tracker(messenger);
-    checkTracking(messenger, tracker);
+    sendMessage(messenger, message, "MapMessage", &id);
 
     setupMessage(message, "ListMessage", address, &id);
     body = pn_message_body(message);
@@ -427,72 +410,1194 @@ int sender(char *sbnamespace, char *entity, char *issuerName, char *issuerKey)
     pn_data_put_string(body, pn_bytes(strlen("String 3"), "String 3"));
     pn_data_put_double(body, 3.14159);
     pn_data_exit(body);
-    printf("CALL pn_messenger_put... ");
-    err = pn_messenger_put(messenger, message);
-    printf("RETURNED %d\n", err);
-    if (err != 0)
+    sendMessage(messenger, message, "ListMessage", &id);
+}
+
+
+/*
+** Sends the messages queued since the last flush and feeds each final
+** status to the pacer, if there is one.
+*/
+int bulkFlush(pn_messenger_t *messenger, pn_tracker_t *trackers, int count,
+              pacer *pace)
+{
+    pn_status_t statuses[BULK_WINDOW];
+    int err;
+    int i;
+
+    int failures = flushTracked(messenger, trackers, count, statuses, &err);
+    if (pace != NULL)
     {
-        protonError(err, "pn_messenger_put", messenger);
+        pacerWindow(pace);
+        if ((err != 0) && isServerBusy(messenger))
+        {
+            pacerServerBusy(pace);
+        }
+        for (i = 0; i < count; i++)
+        {
+            pacerOutcome(pace, statuses[i]);
+        }
     }
-    printf("CALL pn_messenger_send... ");
-#if (PN_VERSION_MINOR == 4)
-    /*
-    ** Proton-C 0.4: pn_messenger_send() always sends all messages which
-    ** have been queued for send by pn_messenger_put().
-    */
-    err = pn_messenger_send(messenger);
+    return failures;
+}
+
+
+/*
+** The time, in milliseconds since the epoch, at which the given message
+** of a -count run is due under -delay and -spread.
+*/
+long long scheduledTime(long long start, long sequence, senderOptions *options)
+{
+    return start + options->delay +
+        (long long)options->spread * sequence / options->count;
+}
+
+
+/*
+** Asks Service Bus to make the message visible at enqueueTime instead of
+** as soon as it arrives.
+*/
+void setScheduledEnqueueTime(pn_message_t *message, pn_timestamp_t enqueueTime)
+{
+    pn_data_t *annotations = pn_message_annotations(message);
+    pn_data_put_map(annotations);
+    pn_data_enter(annotations);
+    pn_data_put_symbol(annotations, pn_bytes(
+        strlen("x-opt-scheduled-enqueue-time"),
+        "x-opt-scheduled-enqueue-time"));
+    pn_data_put_timestamp(annotations, enqueueTime);
+    pn_data_exit(annotations);
+}
+
+
+/*
+** Sends options->count text messages, keeping up to BULK_WINDOW in flight
+** and, if a rate was given, pacing them through a token bucket.
+*/
+void sendBulk(pn_messenger_t *messenger, pn_message_t *message,
+              char *address, senderOptions *options)
+{
+    pn_tracker_t trackers[BULK_WINDOW];
+    int pending = 0;
+    long failures = 0;
+    long sent;
+    char text[64];
+    pn_uuid_t id;
+    pacer pace;
+    pacer *pacing = NULL;
+
+    if (options->rate > 0)
+    {
+        pacerInit(&pace, options->rate, options->burst);
+        pacing = &pace;
+    }
+
+    long long start = currentMicros();
+    long long scheduleStart = currentTime();
+    for (sent = 0; sent < options->count; sent++)
+    {
+        if (pacing != NULL)
+        {
+#if (PN_VERSION_MINOR > 7)
+            /*
+            ** While waiting for a token, let the messenger put the queued
+            ** messages on the wire and take in their outcomes. The window
+            ** is then only flushed when it is full, and by that time most
+            ** of it has been acknowledged already.
+            */
+            long long wait;
+            while ((wait = pacerDelay(pacing)) > 0)
+            {
+                int err = pn_messenger_work(messenger,
+                    (int)((wait + 999) / 1000));
+                if ((err < 0) && (err != PN_TIMEOUT))
+                {
+                    break;
+                }
+            }
 #else
-    /*
-    ** Proton-C 0.5 and later: pn_messenger_send() takes a specific number
-    ** of messages to send, which can also be used to specify blocking or
-    ** nonblocking. This sample uses -1 which blocks until all outgoing
-    ** messages have been sent.
-    */
-    err = pn_messenger_send(messenger, -1);
+            /*
+            ** Queued messages only move when the window is flushed, which
+            ** waits for their acknowledgements. Flush early only when the
+            ** next token is far enough off to hide that round trip, so
+            ** pacing does not cost a round trip per message.
+            */
+            if ((pending > 0) && (pacerDelay(pacing) >= PACING_FLUSH_WAIT))
+            {
+                failures += bulkFlush(messenger, trackers, pending, pacing);
+                pending = 0;
+            }
 #endif
-    printf("RETURNED %d\n", err);
-    if (0 == err)
+            pacerWait(pacing);
+        }
+
+        setupMessage(message, "TextMessage", address, &id);
+        SNPRINTF(text, sizeof(text), "Bulk message %ld", sent);
+        pn_data_put_string(pn_message_body(message),
+            pn_bytes(strlen(text), text));
+        if (options->scheduled)
+        {
+            setScheduledEnqueueTime(message,
+                scheduledTime(scheduleStart, sent, options));
+        }
+
+        int err = pn_messenger_put(messenger, message);
+        if (err != 0)
+        {
+            protonError(err, "pn_messenger_put", messenger);
+            failures++;
+            continue;
+        }
+        trackers[pending++] = pn_messenger_outgoing_tracker(messenger);
+        if (BULK_WINDOW == pending)
+        {
+            failures += bulkFlush(messenger, trackers, pending, pacing);
+            pending = 0;
+        }
+    }
+    if (pending > 0)
     {
-        printf("Sent MapMessage with id\n");
-        outputUuid(&id);
+        failures += bulkFlush(messenger, trackers, pending, pacing);
     }
-    else
+
+    long long elapsed = currentMicros() - start;
+    printf("Sent %ld messages in %.3f s (%.1f/s), %ld failed\n",
+        options->count, elapsed / 1000000.0,
+        (elapsed > 0) ? (options->count * 1000000.0 / elapsed) : 0.0,
+        failures);
+    if (pacing != NULL)
     {
-        protonError(err, "pn_messenger_send", messenger);
+        pacerReport(pacing, true);
     }
-    tracker = pn_messenger_outgoing_tracker(messenger);
-    checkTracking(messenger, tracker);
+}
 
-    printf("CALL pn_messenger_stop... ");
-    err = pn_messenger_stop(messenger);
-    printf("RETURNED %d\n", err);
-    if (err != 0)
+
+/*
+** Sends options->count text messages, each held back until its due time
+** under -delay and -spread. Messages are encoded as they are built and
+** wait in a timer wheel, which costs their encoded size plus a few bytes
+** apiece, so millions can be pending at once. Due messages are released
+** into the outgoing window in due order, and how late each one went out
+** is reported at the end.
+*/
+void sendScheduled(pn_messenger_t *messenger, pn_message_t *message,
+                   char *address, senderOptions *options)
+{
+    timerWheel wheel;
+    histogram lateness;
+    pn_tracker_t trackers[BULK_WINDOW];
+    char buffer[ENCODE_BUFFER_SIZE];
+    int pending = 0;
+    long long firstPending = 0;
+    long built = 0;
+    long sent = 0;
+    long failures = 0;
+    char text[64];
+    pn_uuid_t id;
+    void *data;
+
+    long long start = currentTime();
+    timerWheelInit(&wheel, start);
+    histogramReset(&lateness);
+    printf("Holding %ld messages for %ld ms", options->count, options->delay);
+    if (options->spread > 0)
     {
-        protonError(err, "pn_messenger_stop", messenger);
+        printf(" spread over a further %ld ms", options->spread);
     }
+    printf("\n");
 
-    pn_messenger_free(messenger);
+    while ((built < options->count) || (wheel.count > 0))
+    {
+        long long now = currentTime();
+        if (built < options->count)
+        {
+            setupMessage(message, "TextMessage", address, &id);
+            SNPRINTF(text, sizeof(text), "Scheduled message %ld", built);
+            pn_data_put_string(pn_message_body(message),
+                pn_bytes(strlen(text), text));
 
-    pn_message_free(message);
+            size_t size = sizeof(buffer);
+            int err = pn_message_encode(message, buffer, &size);
+            heldMessage *held = NULL;
+            if (0 == err)
+            {
+                held = (heldMessage *)malloc(sizeof(heldMessage) + size);
+            }
+            if (NULL == held)
+            {
+                printf("Cannot hold message %ld (%d)\n", built, err);
+                failures++;
+            }
+            else
+            {
+                held->due = scheduledTime(start, built, options);
+                held->size = size;
+                memcpy(held->bytes, buffer, size);
+                if (timerWheelAdd(&wheel, held->due, held) != 0)
+                {
+                    printf("Timer wheel is full at message %ld\n", built);
+                    free(held);
+                    failures++;
+                }
+            }
+            built++;
+        }
+        else
+        {
+            /* Everything is held; sleep until the next message is due */
+            if (pending > 0)
+            {
+                failures += bulkFlush(messenger, trackers, pending, NULL);
+                pending = 0;
+            }
+            long long next = timerWheelNextDue(&wheel);
+            now = currentTime();
+            if (next > now)
+            {
+                sleepMicros((next - now) * 1000);
+            }
+            now = currentTime();
+        }
 
-    return 0;
+        timerWheelAdvance(&wheel, now);
+        while (timerWheelNext(&wheel, &data))
+        {
+            heldMessage *held = (heldMessage *)data;
+            pn_message_clear(message);
+            int err = pn_message_decode(message, held->bytes, held->size);
+            long long due = held->due;
+            free(held);
+            if (err != 0)
+            {
+                failures++;
+                continue;
+            }
+            err = pn_messenger_put(messenger, message);
+            if (err != 0)
+            {
+                protonError(err, "pn_messenger_put", messenger);
+                failures++;
+                continue;
+            }
+            histogramRecord(&lateness, currentTimeMicros() - due * 1000);
+            if (0 == pending)
+            {
+                firstPending = now;
+            }
+            sent++;
+            trackers[pending++] = pn_messenger_outgoing_tracker(messenger);
+            if (BULK_WINDOW == pending)
+            {
+                failures += bulkFlush(messenger, trackers, pending, NULL);
+                pending = 0;
+            }
+        }
+
+        /* While still building, do not let released messages sit long */
+        if ((pending > 0) && (now - firstPending >= SCHEDULE_FLUSH_MS))
+        {
+            failures += bulkFlush(messenger, trackers, pending, NULL);
+            pending = 0;
+        }
+    }
+    if (pending > 0)
+    {
+        failures += bulkFlush(messenger, trackers, pending, NULL);
+    }
+
+    printf("Released %ld messages, %ld failed\n", sent, failures);
+    histogramPrint(&lateness, "LATENESS(us)");
+    timerWheelFree(&wheel);
 }
 
 
-int main(int argc, char **argv)
+/*
+** Puts the next window of records from the outbox once the previous one
+** is retired, lets the messenger send for at most wait ms, and commits,
+** in order, what the broker accepted or rejected for good. Records that
+** cannot be decoded are dropped as rejected. A window is only put again
+** once every record in it has a final outcome, so that no stale copy is
+** still queued in the messenger to overtake it. Returns false if the
+** caller should back off: the window had to be put back for another try,
+** the send failed, or nothing in it has had an outcome for
+** OUTBOX_STALL_TIMEOUT ms. A window that is still waiting is kept, and
+** the next call carries on with it.
+*/
+bool outboxDrain(pn_messenger_t *messenger, pn_message_t *message,
+                 char *address, outbox *box, outboxWindow *window, int wait,
+                 long *shipped, long *rejected)
 {
-    if (argc != 5)
+    const char *bytes;
+    size_t size;
+    int retired = 0;
+    int slot;
+    int err;
+
+    bool fresh = (0 == window->count) && !window->failed;
+    bool sendFailed = false;
+    long long now = currentMicros();
+
+    if (fresh)
     {
-        printf("Usage: %s namespace entity issuer-name issuer-key\n", argv[0]);
-        return 1;
+        window->progress = now;
     }
 
-    // For Proton-C versions 0.4-0.6, the key MUST NOT be URL-encoded.
-    // For Proton-C versions 0.7+, the key MUST be URL-encoded.
-#if (PN_VERSION_MINOR >= 7)
-    char *key = urlEncodeKey(argv[4]);
+    while (fresh && (window->count < BULK_WINDOW) &&
+           outboxNext(box, &bytes, &size))
+    {
+        slot = window->count++;
+        window->corrupt[slot] = false;
+        pn_message_clear(message);
+        err = pn_message_decode(message, bytes, size);
+        if (err != 0)
+        {
+            /* It would fail the same way on every try */
+            printf("Dropping undecodable outbox record (%d)\n", err);
+            window->corrupt[slot] = true;
+            continue;
+        }
+
+        /* An earlier run may have spooled for another entity */
+        pn_message_set_address(message, address);
+        err = pn_messenger_put(messenger, message);
+        if (err != 0)
+        {
+            protonError(err, "pn_messenger_put", messenger);
+            window->count--;
+            window->failed = true;
+            break;
+        }
+        window->trackers[slot] = pn_messenger_outgoing_tracker(messenger);
+        window->last = window->trackers[slot];
+        window->hasTracker = true;
+    }
+
+    if (window->hasTracker)
+    {
+        err = pn_messenger_set_timeout(messenger, wait);
+        if (err != 0)
+        {
+            protonError(err, "pn_messenger_set_timeout", messenger);
+        }
+#if (PN_VERSION_MINOR == 4)
+        err = pn_messenger_send(messenger);
+#else
+        err = pn_messenger_send(messenger, -1);
+#endif
+        if ((err != 0) && (err != PN_TIMEOUT))
+        {
+            protonError(err, "pn_messenger_send", messenger);
+            sendFailed = true;
+        }
+    }
+
+    for (; window->done < window->count; window->done++, retired++)
+    {
+        slot = window->done;
+        if (window->corrupt[slot])
+        {
+            (*rejected)++;
+            continue;
+        }
+        pn_status_t status = pn_messenger_status(messenger,
+            window->trackers[slot]);
+        if (PN_STATUS_ACCEPTED == status)
+        {
+            (*shipped)++;
+        }
+        else if (PN_STATUS_REJECTED == status)
+        {
+            /* Sending it again would only be rejected again */
+            (*rejected)++;
+        }
+        else
+        {
+            break;
+        }
+    }
+    outboxAccept(box, retired);
+    if (retired > 0)
+    {
+        window->progress = now;
+    }
+
+    /* Anything still in the messenger must settle before a retry */
+    for (slot = window->done; slot < window->count; slot++)
+    {
+        if (!window->corrupt[slot] && !isFinalStatus(
+            pn_messenger_status(messenger, window->trackers[slot])))
+        {
+            return !sendFailed &&
+                (now - window->progress < OUTBOX_STALL_TIMEOUT * 1000LL);
+        }
+    }
+
+    bool complete = (window->done == window->count) && !window->failed;
+    if (window->hasTracker)
+    {
+        pn_messenger_settle(messenger, window->last, PN_CUMULATIVE);
+    }
+    window->count = 0;
+    window->done = 0;
+    window->failed = false;
+    window->hasTracker = false;
+    if (!complete)
+    {
+        outboxRetry(box);
+    }
+    return complete;
+}
+
+
+/*
+** Sends options->count text messages through the outbox in
+** options->outboxDir, after anything an earlier run left there. Every
+** message is appended to the outbox before it is sent, and is only
+** removed once the broker has accepted it. Sending never blocks the
+** producer: while messages are left to spool, the messenger is only
+** polled. While the broker cannot be reached, messages keep being
+** appended, and sending is retried with exponential backoff. Once the
+** broker is back, the outbox drains in order in full windows.
+*/
+void sendOutbox(pn_messenger_t *messenger, pn_message_t *message,
+                char *address, senderOptions *options)
+{
+    outbox box;
+    outboxWindow window;
+    char buffer[ENCODE_BUFFER_SIZE];
+    char text[64];
+    pn_uuid_t id;
+    long built = 0;
+    long shipped = 0;
+    long rejected = 0;
+    long retries = 0;
+    long long peak = 0;
+    long long retryAt = 0;
+    int backoff = 0;
+    int i;
+
+    if (outboxOpen(&box, options->outboxDir) != 0)
+    {
+        return;
+    }
+
+    memset(&window, 0, sizeof(window));
+    int err = 0;
+    long long start = currentMicros();
+    while ((built < options->count) || (box.pending > 0))
+    {
+        for (i = 0; (i < BULK_WINDOW) && (built < options->count); i++)
+        {
+            setupMessage(message, "TextMessage", address, &id);
+            SNPRINTF(text, sizeof(text), "Spooled message %ld", built);
+            pn_data_put_string(pn_message_body(message),
+                pn_bytes(strlen(text), text));
+            size_t size = sizeof(buffer);
+            err = pn_message_encode(message, buffer, &size);
+            if ((err != 0) || (outboxAppend(&box, buffer, size) != 0))
+            {
+                printf("Cannot spool message %ld (%d), stopping\n", built,
+                    err);
+                options->count = built;
+                break;
+            }
+            built++;
+        }
+        /* One flush covers this batch and what the last drain committed */
+        outboxSync(&box);
+        if (box.pending > peak)
+        {
+            peak = box.pending;
+        }
+
+        long long now = currentMicros();
+        if (now < retryAt)
+        {
+            if (built >= options->count)
+            {
+                sleepMicros(retryAt - now);
+            }
+            continue;
+        }
+        if (0 == box.pending)
+        {
+            continue;
+        }
+
+        /* Only wait on the broker once there is nothing left to spool */
+        int wait = (built < options->count) ? 0 : OUTBOX_IDLE_WAIT;
+        if (outboxDrain(messenger, message, address, &box, &window, wait,
+            &shipped, &rejected))
+        {
+            backoff = 0;
+        }
+        else
+        {
+            backoff = (0 == backoff) ? OUTBOX_MIN_BACKOFF :
+                ((2 * backoff > OUTBOX_MAX_BACKOFF) ? OUTBOX_MAX_BACKOFF :
+                 2 * backoff);
+            retryAt = currentMicros() + backoff * 1000LL;
+            retries++;
+            printf("Broker unavailable, %lld messages spooled, retrying in "
+                "%d ms\n", box.pending, backoff);
+        }
+    }
+
+    long long elapsed = currentMicros() - start;
+    printf("Shipped %ld messages in %.3f s (%.1f/s), %ld rejected, "
+        "%ld retries, at most %lld spooled\n", shipped, elapsed / 1000000.0,
+        (elapsed > 0) ? (shipped * 1000000.0 / elapsed) : 0.0, rejected,
+        retries, peak);
+    outboxClose(&box);
+}
+
+
+/*
+** True for annotations Service Bus adds on delivery (sequence number,
+** enqueued time, lock token and so on). The few x-opt-* annotations a
+** sender sets itself are kept.
+*/
+bool isBrokerAnnotation(pn_bytes_t key)
+{
+    const char *kept[] = { "x-opt-partition-key", "x-opt-via-partition-key",
+        "x-opt-scheduled-enqueue-time" };
+    size_t i;
+
+    if ((key.size < 6) || (memcmp(key.start, "x-opt-", 6) != 0))
+    {
+        return false;
+    }
+    for (i = 0; i < sizeof(kept) / sizeof(kept[0]); i++)
+    {
+        if ((key.size == strlen(kept[i])) &&
+            (0 == memcmp(key.start, kept[i], key.size)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*
+** Rewrites the map in data without the entries whose key drop() picks,
+** leaving data inside the new map so that the caller can add entries
+** and then pn_data_exit(). Only simple values are kept, which is all that
+** application properties may hold and all that annotations use here.
+*/
+void rewriteMap(pn_data_t *data, pn_data_t *scratch,
+                bool (*drop)(pn_bytes_t key))
+{
+    pn_data_clear(scratch);
+    pn_data_rewind(data);
+    if (pn_data_next(data) && (PN_MAP == pn_data_type(data)))
+    {
+        pn_data_enter(data);
+        while (pn_data_next(data))
+        {
+            pn_atom_t key = pn_data_get_atom(data);
+            if (!pn_data_next(data))
+            {
+                break;
+            }
+            pn_type_t type = pn_data_type(data);
+            bool simple = (type != PN_MAP) && (type != PN_LIST) &&
+                (type != PN_ARRAY) && (type != PN_DESCRIBED);
+            bool named = (PN_STRING == key.type) || (PN_SYMBOL == key.type);
+            if (simple && !(named && drop(key.u.as_bytes)))
+            {
+                pn_data_put_atom(scratch, key);
+                pn_data_put_atom(scratch, pn_data_get_atom(data));
+            }
+        }
+    }
+
+    pn_data_clear(data);
+    pn_data_put_map(data);
+    pn_data_enter(data);
+    pn_data_rewind(scratch);
+    while (pn_data_next(scratch))
+    {
+        pn_data_put_atom(data, pn_data_get_atom(scratch));
+    }
+}
+
+
+bool isSendStamp(pn_bytes_t key)
+{
+    return (key.size == strlen(LATENCY_SEND_PROPERTY)) &&
+        (0 == memcmp(key.start, LATENCY_SEND_PROPERTY, key.size));
+}
+
+
+/*
+** Makes a captured message fit to send again. Service Bus would drop a
+** copy carrying the original message-id as a duplicate, the latency
+** stamp and creation time should be those of the replay, and the
+** annotations the broker added when it delivered the message mean
+** nothing to the entity it is replayed to.
+*/
+void restampReplayed(pn_message_t *message, pn_data_t *scratch)
+{
+    pn_atom_t id;
+    id.type = PN_UUID;
+    generateUuid(&id.u.as_uuid);
+    pn_message_set_id(message, id);
+    pn_message_set_creation_time(message, currentTime());
+
+    pn_data_t *properties = pn_message_properties(message);
+    rewriteMap(properties, scratch, isSendStamp);
+    latencyStamp(properties);
+    pn_data_exit(properties);
+
+    pn_data_t *annotations = pn_message_annotations(message);
+    pn_data_rewind(annotations);
+    if (pn_data_next(annotations))
+    {
+        rewriteMap(annotations, scratch, isBrokerAnnotation);
+        pn_data_exit(annotations);
+    }
+}
+
+
+/*
+** Replays a trace captured by "receiver -capture" against address,
+** keeping the recorded gaps between messages divided by options->speed.
+** The encoded messages are read straight from the memory-mapped trace
+** and decoded in place. Each is then sent to address as a new message:
+** with a new id and send time, and without the annotations the broker
+** added when it was first delivered.
+*/
+void sendReplay(pn_messenger_t *messenger, pn_message_t *message,
+                char *address, senderOptions *options)
+{
+    traceReader reader;
+    pn_tracker_t trackers[BULK_WINDOW];
+    int pending = 0;
+    long sent = 0;
+    long failures = 0;
+    long long arrival;
+    const char *bytes;
+    size_t length;
+
+    if (traceOpen(&reader, options->replayFile) != 0)
+    {
+        return;
+    }
+    pn_data_t *scratch = pn_data(16);
+    if (options->speed > 0)
+    {
+        printf("Replaying %s at %gx\n", options->replayFile, options->speed);
+    }
+    else
+    {
+        printf("Replaying %s at maximum speed\n", options->replayFile);
+    }
+
+    long long start = currentMicros();
+    while (traceNext(&reader, &arrival, &bytes, &length))
+    {
+        if (options->speed > 0)
+        {
+            long long due = start + (long long)(arrival / options->speed);
+            long long now = currentMicros();
+            if (due > now)
+            {
+                /* Do not sit on queued messages while waiting */
+                if (pending > 0)
+                {
+                    failures += bulkFlush(messenger, trackers, pending, NULL);
+                    pending = 0;
+                    now = currentMicros();
+                }
+                sleepMicros(due - now);
+            }
+        }
+
+        pn_message_clear(message);
+        int err = pn_message_decode(message, bytes, length);
+        if (err != 0)
+        {
+            printf("Skipping undecodable trace record %ld (%d)\n", sent, err);
+            failures++;
+            continue;
+        }
+        /*
+        ** Messenger only sends pn_message_t, so retargeting the message
+        ** at this entity means encoding it once more in _put().
+        */
+        pn_message_set_address(message, address);
+        restampReplayed(message, scratch);
+
+        err = pn_messenger_put(messenger, message);
+        if (err != 0)
+        {
+            protonError(err, "pn_messenger_put", messenger);
+            failures++;
+            continue;
+        }
+        sent++;
+        trackers[pending++] = pn_messenger_outgoing_tracker(messenger);
+        if (BULK_WINDOW == pending)
+        {
+            failures += bulkFlush(messenger, trackers, pending, NULL);
+            pending = 0;
+        }
+    }
+    if (pending > 0)
+    {
+        failures += bulkFlush(messenger, trackers, pending, NULL);
+    }
+
+    long long elapsed = currentMicros() - start;
+    printf("Replayed %ld messages in %.3f s (%.1f/s), %ld failed\n", sent,
+        elapsed / 1000000.0,
+        (elapsed > 0) ? (sent * 1000000.0 / elapsed) : 0.0, failures);
+    pn_data_free(scratch);
+    traceUnmap(&reader);
+}
+
+
+int sender(char *sbnamespace, char *entity, char *issuerName, char *issuerKey,
+           senderOptions *options)
+{
+    char address[500];
+    if (options->url != NULL)
+    {
+        SNPRINTF(address, sizeof(address), "%s/%s", options->url, entity);
+    }
+    else
+    {
+        SNPRINTF(address, sizeof(address),
+            "amqps://%s:%s@%s." SERVICEBUS_DOMAIN "/%s",
+            issuerName, issuerKey, sbnamespace, entity);
+    }
+
+    printf("Sending messages to %s\n", address);
+
+    pn_messenger_t *messenger = pn_messenger(NULL);
+
+    printf("CALL pn_messenger_set_outgoing_window... ");
+    /*
+    ** 5 is an arbitrary number here. It is not really necessary
+    ** with blocking send, but if you are not using blocking send
+    ** it determines how many outgoing messages you can track the
+    ** status of. Streams and bulk sends keep several messages in
+    ** flight and need to track all of them.
+    */
+    int window = 5;
+    if (options->streamFile != NULL)
+    {
+        window = STREAM_WINDOW;
+    }
+    else if (options->partitions > 0)
+    {
+        window = PARTITION_WINDOW;
+    }
+    else if (options->priorityCount > 0)
+    {
+        window = PRIORITY_WINDOW;
+    }
+    else if ((options->count > 0) || (options->replayFile != NULL) ||
+        (options->outboxDir != NULL))
+    {
+        window = BULK_WINDOW;
+    }
+    else if (options->rpcCount > 0)
+    {
+        /* The reply is the acknowledgement, so sends are not tracked */
+        window = 0;
+    }
+    else if (options->daemonSocket != NULL)
+    {
+        window = SIDECAR_WINDOW;
+    }
+    int err = pn_messenger_set_outgoing_window(messenger, window);
+    printf("RETURNED %d\n", err);
+    if (err != 0)
+    {
+        protonError(err, "pn_messenger_set_outgoing_window", messenger);
+        return -1;
+    }
+
+#if (PN_VERSION_MINOR > 4) && defined(USE_BLOCKING_SEND)
+    printf("CALL pn_messenger_set_blocking... ");
+    /*
+    ** The RPC client, the daemon, partitioned and prioritized sends
+    ** interleave the messenger with other work in one loop, so they must
+    ** not block in it.
+    */
+    err = pn_messenger_set_blocking(messenger,
+        (0 == options->rpcCount) && (NULL == options->daemonSocket) &&
+        (0 == options->partitions) && (0 == options->priorityCount));
+    printf("RETURNED %d\n", err);
+    if (err != 0)
+    {
+        protonError(err, "pn_messenger_set_blocking", messenger);
+        return -1;
+    }
+#endif
+
+    printf("CALL pn_messenger_start... ");
+    err = pn_messenger_start(messenger);
+    printf("RETURNED %d\n", err);
+    if (err != 0)
+    {
+        protonError(err, "pn_messenger_start", messenger);
+        return -1;
+    }
+
+    pn_message_t *message = pn_message();
+
+    if (options->streamFile != NULL)
+    {
+        FILE *file = stdin;
+        if (strcmp(options->streamFile, "-") != 0)
+        {
+            file = fopen(options->streamFile, "rb");
+        }
+        if (NULL == file)
+        {
+            printf("ERROR: cannot open %s\n", options->streamFile);
+        }
+        else
+        {
+            streamSend(messenger, message, address, fileSource, file,
+                options->chunkSize);
+            if (file != stdin)
+            {
+                fclose(file);
+            }
+        }
+    }
+    else if (options->outboxDir != NULL)
+    {
+        sendOutbox(messenger, message, address, options);
+    }
+    else if (options->partitions > 0)
+    {
+        partitionSend(messenger, message, address, options->count,
+            options->partitions, options->keys, options->sessions);
+    }
+    else if (options->priorityCount > 0)
+    {
+        prioritySend(messenger, message, address, options->priorities,
+            options->priorityCount);
+    }
+    else if ((options->count > 0) && !options->scheduled &&
+        ((options->delay > 0) || (options->spread > 0)))
+    {
+        sendScheduled(messenger, message, address, options);
+    }
+    else if (options->count > 0)
+    {
+        sendBulk(messenger, message, address, options);
+    }
+    else if (options->replayFile != NULL)
+    {
+        sendReplay(messenger, message, address, options);
+    }
+    else if (options->daemonSocket != NULL)
+    {
+        sidecarDaemon(messenger, message, address, options->daemonSocket);
+    }
+    else if (options->rpcCount > 0)
+    {
+        char replyAddress[500];
+        SNPRINTF(replyAddress, sizeof(replyAddress),
+            "amqps://%s:%s@%s." SERVICEBUS_DOMAIN "/%s",
+            issuerName, issuerKey, sbnamespace, options->replyTo);
+        rpcClient(messenger, message, address, replyAddress, options->replyTo,
+            options->rpcCount, options->outstanding, options->timeout);
+    }
+    else
+    {
+        sendSamples(messenger, message, address);
+    }
+
+    printf("CALL pn_messenger_stop... ");
+    err = pn_messenger_stop(messenger);
+    printf("RETURNED %d\n", err);
+    if (err != 0)
+    {
+        protonError(err, "pn_messenger_stop", messenger);
+    }
+
+    pn_messenger_free(messenger);
+
+    pn_message_free(message);
+
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    senderOptions options;
+    int i;
+
+    /*
+    ** A client of a running daemon needs no namespace or key of its own,
+    ** so it gets a command line of its own.
+    */
+    if ((argc >= 2) && (0 == strcmp(argv[1], "-via")))
+    {
+        if (argc != 4)
+        {
+            printf("Usage: %s -via socket-path count\n", argv[0]);
+            return 1;
+        }
+        return (0 == sidecarClient(argv[2], strtol(argv[3], NULL, 10))) ? 0 : 1;
+    }
+
+    memset(&options, 0, sizeof(options));
+    options.chunkSize = STREAM_DEFAULT_CHUNK;
+    options.outstanding = RPC_DEFAULT_OUTSTANDING;
+    options.timeout = RPC_DEFAULT_TIMEOUT;
+    options.speed = 1.0;
+
+    for (i = 5; i < argc; i++)
+    {
+        if ((0 == strcmp(argv[i], "-stream")) && (i + 1 < argc))
+        {
+            options.streamFile = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-chunk")) && (i + 1 < argc))
+        {
+            options.chunkSize = (size_t)strtoul(argv[++i], NULL, 10);
+            if ((0 == options.chunkSize) ||
+                (options.chunkSize > STREAM_MAX_CHUNK))
+            {
+                printf("Chunk size must be between 1 and %d\n",
+                    STREAM_MAX_CHUNK);
+                return 1;
+            }
+        }
+        else if ((0 == strcmp(argv[i], "-count")) && (i + 1 < argc))
+        {
+            options.count = strtol(argv[++i], NULL, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-rate")) && (i + 1 < argc))
+        {
+            options.rate = strtod(argv[++i], NULL);
+        }
+        else if ((0 == strcmp(argv[i], "-burst")) && (i + 1 < argc))
+        {
+            options.burst = strtod(argv[++i], NULL);
+        }
+        else if ((0 == strcmp(argv[i], "-rpc")) && (i + 1 < argc))
+        {
+            options.rpcCount = strtol(argv[++i], NULL, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-replyto")) && (i + 1 < argc))
+        {
+            options.replyTo = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-outstanding")) && (i + 1 < argc))
+        {
+            options.outstanding = atoi(argv[++i]);
+            if ((options.outstanding < 1) ||
+                (options.outstanding > RPC_MAX_OUTSTANDING))
+            {
+                printf("Outstanding must be between 1 and %d\n",
+                    RPC_MAX_OUTSTANDING);
+                return 1;
+            }
+        }
+        else if ((0 == strcmp(argv[i], "-timeout")) && (i + 1 < argc))
+        {
+            options.timeout = atoi(argv[++i]);
+            if (options.timeout < 1)
+            {
+                printf("Timeout must be at least 1 ms\n");
+                return 1;
+            }
+        }
+        else if ((0 == strcmp(argv[i], "-replay")) && (i + 1 < argc))
+        {
+            options.replayFile = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-daemon")) && (i + 1 < argc))
+        {
+            options.daemonSocket = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-delay")) && (i + 1 < argc))
+        {
+            options.delay = strtol(argv[++i], NULL, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-spread")) && (i + 1 < argc))
+        {
+            options.spread = strtol(argv[++i], NULL, 10);
+        }
+        else if (0 == strcmp(argv[i], "-scheduled"))
+        {
+            options.scheduled = true;
+        }
+        else if ((0 == strcmp(argv[i], "-outbox")) && (i + 1 < argc))
+        {
+            options.outboxDir = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-partitions")) && (i + 1 < argc))
+        {
+            options.partitions = atoi(argv[++i]);
+            if ((options.partitions < 1) ||
+                (options.partitions > PARTITION_MAX_COUNT))
+            {
+                printf("Partitions must be between 1 and %d\n",
+                    PARTITION_MAX_COUNT);
+                return 1;
+            }
+        }
+        else if ((0 == strcmp(argv[i], "-keys")) && (i + 1 < argc))
+        {
+            options.keys = atoi(argv[++i]);
+            if (options.keys < 1)
+            {
+                printf("Keys must be at least 1\n");
+                return 1;
+            }
+        }
+        else if (0 == strcmp(argv[i], "-sessions"))
+        {
+            options.sessions = true;
+        }
+        else if ((0 == strcmp(argv[i], "-priority")) && (i + 1 < argc))
+        {
+            options.priorityCount = priorityParse(argv[++i],
+                options.priorities, PRIORITY_MAX_CLASSES);
+            if (options.priorityCount < 1)
+            {
+                return 1;
+            }
+        }
+        else if ((0 == strcmp(argv[i], "-url")) && (i + 1 < argc))
+        {
+            options.url = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-speed")) && (i + 1 < argc))
+        {
+            i++;
+            options.speed = (0 == strcmp(argv[i], "max")) ? 0.0 :
+                strtod(argv[i], NULL);
+        }
+        else
+        {
+            argc = 0; /* force the usage message */
+            break;
+        }
+    }
+
+    if ((options.rpcCount > 0) && (NULL == options.replyTo))
+    {
+        printf("-rpc needs -replyto\n");
+        argc = 0;
+    }
+
+    if (((options.keys > 0) || options.sessions) && (0 == options.partitions))
+    {
+        options.partitions = PARTITION_DEFAULT_COUNT;
+    }
+    if (0 == options.keys)
+    {
+        options.keys = PARTITION_DEFAULT_KEYS;
+    }
+    if ((options.partitions > 0) && (0 == options.count))
+    {
+        printf("-partitions, -keys and -sessions need -count\n");
+        argc = 0;
+    }
+
+    if (((options.delay != 0) || (options.spread != 0) || options.scheduled)
+        && ((0 == options.count) || (options.delay < 0) ||
+            (options.spread < 0)))
+    {
+        printf("-delay, -spread and -scheduled need -count, and times "
+            "must not be negative\n");
+        argc = 0;
+    }
+    if ((options.rate > 0) && !options.scheduled &&
+        ((options.delay > 0) || (options.spread > 0)))
+    {
+        /* Held messages go out when due, so there is nothing to pace */
+        printf("-rate cannot be combined with -delay or -spread; use "
+            "-spread to set the rate\n");
+        argc = 0;
+    }
+
+    if (argc < 5)
+    {
+        printf("Usage: %s namespace entity issuer-name issuer-key "
+            "[options]\n", argv[0]);
+        printf("  -stream file    stream a file (\"-\" for stdin) in "
+            "chunks instead\n"
+            "                  of sending the four sample messages\n");
+        printf("  -chunk bytes    stream chunk size (default %d)\n",
+            STREAM_DEFAULT_CHUNK);
+        printf("  -count n        send n text messages instead of the "
+            "samples\n");
+        printf("  -rate r         pace -count sends at up to r messages/s, "
+            "backing off\n"
+            "                  when the broker throttles\n");
+        printf("  -burst b        messages -rate may send back to back "
+            "(default 1)\n");
+        printf("  -delay ms       hold each -count message for ms before "
+            "sending it\n");
+        printf("  -spread ms      spread the due times of -count messages "
+            "evenly over a\n"
+            "                  further ms\n");
+        printf("  -scheduled      have the broker hold messages until "
+            "their due time\n"
+            "                  (x-opt-scheduled-enqueue-time) instead\n");
+        printf("  -outbox dir     spool -count messages through a local "
+            "outbox in dir,\n"
+            "                  draining it in order whenever the broker "
+            "is reachable\n");
+        printf("  -partitions n   send -count messages with partition keys, "
+            "reporting load\n"
+            "                  skew over n local partitions "
+            "(default %d)\n", PARTITION_DEFAULT_COUNT);
+        printf("  -keys k         number of distinct partition keys "
+            "(default %d)\n", PARTITION_DEFAULT_KEYS);
+        printf("  -sessions       also use each partition key as the "
+            "message's SessionId\n");
+        printf("  -priority spec  send a workload of priority classes, "
+            "each spec entry\n"
+            "                  being name:weight|strict:count:size[:rate]"
+            "\n");
+        printf("  -rpc n          send n requests and wait for correlated "
+            "replies\n");
+        printf("  -replyto path   entity that -rpc replies are sent to\n");
+        printf("  -outstanding k  -rpc requests awaiting a reply at once "
+            "(default %d)\n", RPC_DEFAULT_OUTSTANDING);
+        printf("  -timeout ms     how long -rpc waits for a reply "
+            "(default %d)\n", RPC_DEFAULT_TIMEOUT);
+        printf("  -replay file    send the messages in a trace captured by "
+            "\"receiver -capture\"\n");
+        printf("  -speed x        replay at x times the captured rate, or "
+            "\"max\" (default 1)\n");
+        printf("  -daemon path    stay connected and forward messages "
+            "written to the\n"
+            "                  Unix socket at path; see sidecar.h\n");
+        printf("  -url base       send to base/entity instead of Service Bus, "
+            "for example\n"
+            "                  amqp://127.0.0.1:5673\n");
+        printf("       %s -via socket-path count\n", argv[0]);
+        printf("                  hand count messages to a running "
+            "daemon\n");
+        return 1;
+    }
+
+    // For Proton-C versions 0.4-0.6, the key MUST NOT be URL-encoded.
+    // For Proton-C versions 0.7+, the key MUST be URL-encoded.
+#if (PN_VERSION_MINOR >= 7)
+    char *key = urlEncodeKey(argv[4]);
 #else
     char *key = argv[4];
 #endif
-    sender(argv[1], argv[2], argv[3], key);
+    sender(argv[1], argv[2], argv[3], key, &options);
+
+#if (PN_VERSION_MINOR >= 7)
+    free(key);
+#endif
+    return 0;
 }
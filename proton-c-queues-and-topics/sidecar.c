@@ -0,0 +1,567 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "proton/message.h"
+#include "proton/messenger.h"
+#include "proton/error.h"
+#ifndef PN_VERSION_MAJOR
+#include "proton/version.h"
+#endif
+
+#include "common.h"
+#include "histogram.h"
+#include "sidecar.h"
+
+#if !defined(_WIN32) && (PN_VERSION_MINOR > 7)
+
+/* Frames a client may send before the daemon stops reading from it */
+#define SIDECAR_READ_SIZE	(64 * 1024)
+#define SIDECAR_IDLE_POLL	100	/* milliseconds */
+
+typedef struct sidecarClientState
+{
+    int fd;
+    long long id;         /* distinguishes reuses of the same slot */
+    char *in;
+    size_t inSize;
+    size_t inCapacity;
+    char *out;
+    size_t outSize;
+    size_t outCapacity;
+} sidecarClientState;
+
+typedef struct sidecarPending
+{
+    pn_tracker_t tracker;
+    int client;
+    long long clientId;
+    unsigned int sequence;
+    bool failed;          /* could not be queued, there is no tracker */
+} sidecarPending;
+
+static volatile sig_atomic_t sidecarStop = 0;
+
+static void sidecarSignal(int signo)
+{
+    (void)signo;
+    sidecarStop = 1;
+}
+
+
+static void putUint32(char *to, unsigned int value)
+{
+    unsigned int n = htonl(value);
+    memcpy(to, &n, 4);
+}
+
+
+static unsigned int getUint32(const char *from)
+{
+    unsigned int n;
+    memcpy(&n, from, 4);
+    return ntohl(n);
+}
+
+
+static int growBuffer(char **buffer, size_t *capacity, size_t needed)
+{
+    size_t size = (*capacity > 0) ? *capacity : 4096;
+    while (size < needed)
+    {
+        size *= 2;
+    }
+    if (size != *capacity)
+    {
+        char *bigger = (char *)realloc(*buffer, size);
+        if (NULL == bigger)
+        {
+            return -1;
+        }
+        *buffer = bigger;
+        *capacity = size;
+    }
+    return 0;
+}
+
+
+static void closeClient(sidecarClientState *client)
+{
+    close(client->fd);
+    free(client->in);
+    free(client->out);
+    memset(client, 0, sizeof(sidecarClientState));
+    client->fd = -1;
+}
+
+
+static void queueAck(sidecarClientState *client, unsigned int sequence,
+                     int status)
+{
+    if (growBuffer(&client->out, &client->outCapacity,
+        client->outSize + SIDECAR_ACK_SIZE) != 0)
+    {
+        return;
+    }
+    putUint32(client->out + client->outSize, sequence);
+    client->out[client->outSize + 4] = (char)status;
+    client->outSize += SIDECAR_ACK_SIZE;
+}
+
+
+/*
+** Queues one frame's message on the messenger. Returns false if the frame
+** was malformed or the message could not be put.
+*/
+static bool putFrame(pn_messenger_t *messenger, pn_message_t *message,
+                     char *address, const char *frame, size_t length)
+{
+    int format = frame[4];
+    const char *payload = frame + 5;
+    size_t payloadSize = length - 5;
+
+    pn_message_clear(message);
+    if (SIDECAR_FORMAT_MESSAGE == format)
+    {
+        if (pn_message_decode(message, payload, payloadSize) != 0)
+        {
+            return false;
+        }
+    }
+    else if (SIDECAR_FORMAT_BODY == format)
+    {
+        pn_message_set_creation_time(message, currentTime());
+        pn_data_put_binary(pn_message_body(message),
+            pn_bytes(payloadSize, payload));
+    }
+    else
+    {
+        return false;
+    }
+    pn_message_set_address(message, address);
+
+    int err = pn_messenger_put(messenger, message);
+    if (err != 0)
+    {
+        protonError(err, "pn_messenger_put", messenger);
+        return false;
+    }
+    return true;
+}
+
+
+int sidecarDaemon(pn_messenger_t *messenger, pn_message_t *message,
+                  char *address, const char *socketPath)
+{
+    sidecarClientState clients[SIDECAR_MAX_CLIENTS];
+    struct pollfd fds[SIDECAR_MAX_CLIENTS + 1];
+    int slots[SIDECAR_MAX_CLIENTS + 1];
+    sidecarPending *pending;
+    size_t head = 0;
+    size_t inFlight = 0;
+    long long nextClientId = 1;
+    long long forwarded = 0;
+    int i;
+
+    pending = (sidecarPending *)malloc(SIDECAR_WINDOW * sizeof(sidecarPending));
+    if (NULL == pending)
+    {
+        return -1;
+    }
+    for (i = 0; i < SIDECAR_MAX_CLIENTS; i++)
+    {
+        memset(&clients[i], 0, sizeof(sidecarClientState));
+        clients[i].fd = -1;
+    }
+
+    struct sockaddr_un local;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(local.sun_path))
+    {
+        printf("ERROR: socket path %s is too long\n", socketPath);
+        free(pending);
+        return -1;
+    }
+    strcpy(local.sun_path, socketPath);
+    unlink(socketPath);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((listener < 0) ||
+        (bind(listener, (struct sockaddr *)&local, sizeof(local)) != 0) ||
+        (listen(listener, SIDECAR_MAX_CLIENTS) != 0))
+    {
+        printf("ERROR: cannot listen on %s: %s\n", socketPath,
+            strerror(errno));
+        free(pending);
+        return -1;
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+
+    signal(SIGINT, sidecarSignal);
+    signal(SIGTERM, sidecarSignal);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Daemon listening on %s, forwarding to %s\n", socketPath, address);
+
+    while (!sidecarStop)
+    {
+        int nfds = 0;
+        int connected = 0;
+
+        fds[nfds].fd = listener;
+        fds[nfds].events = POLLIN;
+        slots[nfds++] = -1;
+        for (i = 0; i < SIDECAR_MAX_CLIENTS; i++)
+        {
+            if (clients[i].fd < 0)
+            {
+                continue;
+            }
+            connected++;
+            fds[nfds].fd = clients[i].fd;
+            /* Stop reading while the window is full: that is backpressure */
+            fds[nfds].events = (inFlight < SIDECAR_WINDOW) ? POLLIN : 0;
+            if (clients[i].outSize > 0)
+            {
+                fds[nfds].events |= POLLOUT;
+            }
+            slots[nfds++] = i;
+        }
+        if (connected == SIDECAR_MAX_CLIENTS)
+        {
+            fds[0].events = 0;
+        }
+
+        /*
+        ** The messenger's sockets are not visible here, so while messages
+        ** are in flight poll briefly and go back to pumping the messenger.
+        ** When idle, still wake up for the messenger's next deadline, so
+        ** that heartbeats keep the connection open.
+        */
+        int timeout = (inFlight > 0) ? 1 : SIDECAR_IDLE_POLL;
+        pn_timestamp_t deadline = pn_messenger_deadline(messenger);
+        if (deadline > 0)
+        {
+            long long wait = (long long)deadline - currentTimeMicros() / 1000;
+            if (wait < timeout)
+            {
+                timeout = (wait > 0) ? (int)wait : 0;
+            }
+        }
+        poll(fds, nfds, timeout);
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept(listener, NULL, NULL);
+            for (i = 0; (fd >= 0) && (i < SIDECAR_MAX_CLIENTS); i++)
+            {
+                if (clients[i].fd < 0)
+                {
+                    fcntl(fd, F_SETFL, O_NONBLOCK);
+                    clients[i].fd = fd;
+                    clients[i].id = nextClientId++;
+                    fd = -1;
+                }
+            }
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        for (i = 1; i < nfds; i++)
+        {
+            sidecarClientState *client = &clients[slots[i]];
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                if (growBuffer(&client->in, &client->inCapacity,
+                    client->inSize + SIDECAR_READ_SIZE) != 0)
+                {
+                    closeClient(client);
+                    continue;
+                }
+                ssize_t got = read(client->fd, client->in + client->inSize,
+                    SIDECAR_READ_SIZE);
+                if (0 == got || ((got < 0) && (errno != EAGAIN) &&
+                    (errno != EINTR)))
+                {
+                    closeClient(client);
+                    continue;
+                }
+                if (got > 0)
+                {
+                    client->inSize += (size_t)got;
+                }
+            }
+            if ((fds[i].revents & POLLOUT) && (client->outSize > 0))
+            {
+                ssize_t wrote = write(client->fd, client->out,
+                    client->outSize);
+                if (wrote > 0)
+                {
+                    memmove(client->out, client->out + wrote,
+                        client->outSize - (size_t)wrote);
+                    client->outSize -= (size_t)wrote;
+                }
+                else if ((wrote < 0) && (errno != EAGAIN) && (errno != EINTR))
+                {
+                    closeClient(client);
+                }
+            }
+        }
+
+        /* Turn complete frames into messages while the window has room */
+        bool queued = false;
+        for (i = 0; i < SIDECAR_MAX_CLIENTS; i++)
+        {
+            sidecarClientState *client = &clients[i];
+            size_t used = 0;
+            while ((client->fd >= 0) && (inFlight < SIDECAR_WINDOW) &&
+                (client->inSize - used >= 4))
+            {
+                unsigned int length = getUint32(client->in + used);
+                if ((length < 5) || (length > SIDECAR_MAX_FRAME))
+                {
+                    printf("Bad frame length %u, dropping client\n", length);
+                    closeClient(client);
+                    break;
+                }
+                if (client->inSize - used - 4 < length)
+                {
+                    break;
+                }
+                const char *frame = client->in + used + 4;
+                unsigned int sequence = getUint32(frame);
+                /*
+                ** A frame that cannot be queued still takes its place in
+                ** the ring, so that its ack goes out after those of the
+                ** client's earlier messages.
+                */
+                sidecarPending *p =
+                    &pending[(head + inFlight) % SIDECAR_WINDOW];
+                p->failed = !putFrame(messenger, message, address, frame,
+                    length);
+                if (!p->failed)
+                {
+                    p->tracker = pn_messenger_outgoing_tracker(messenger);
+                    queued = true;
+                }
+                p->client = i;
+                p->clientId = client->id;
+                p->sequence = sequence;
+                inFlight++;
+                used += 4 + length;
+            }
+            if ((client->fd >= 0) && (used > 0))
+            {
+                memmove(client->in, client->in + used, client->inSize - used);
+                client->inSize -= used;
+            }
+        }
+
+        if (queued)
+        {
+            int err = pn_messenger_send(messenger, -1);
+            if ((err != 0) && (err != PN_INPROGRESS))
+            {
+                protonError(err, "pn_messenger_send", messenger);
+            }
+        }
+        pn_messenger_work(messenger, 0);
+
+        /* Ack, in order, every message whose outcome is now known */
+        pn_tracker_t lastFinal = 0;
+        bool anyFinal = false;
+        while (inFlight > 0)
+        {
+            sidecarPending *p = &pending[head];
+            int status = SIDECAR_STATUS_FAILED;
+            if (!p->failed)
+            {
+                pn_status_t outcome =
+                    pn_messenger_status(messenger, p->tracker);
+                if (!isFinalStatus(outcome))
+                {
+                    break;
+                }
+                status = (int)outcome;
+                lastFinal = p->tracker;
+                anyFinal = true;
+                forwarded++;
+            }
+            sidecarClientState *client = &clients[p->client];
+            if ((client->fd >= 0) && (client->id == p->clientId))
+            {
+                queueAck(client, p->sequence, status);
+            }
+            head = (head + 1) % SIDECAR_WINDOW;
+            inFlight--;
+        }
+        if (anyFinal)
+        {
+            pn_messenger_settle(messenger, lastFinal, PN_CUMULATIVE);
+        }
+    }
+
+    printf("Daemon stopping after forwarding %lld messages\n", forwarded);
+    for (i = 0; i < SIDECAR_MAX_CLIENTS; i++)
+    {
+        if (clients[i].fd >= 0)
+        {
+            closeClient(&clients[i]);
+        }
+    }
+    close(listener);
+    unlink(socketPath);
+    free(pending);
+    return 0;
+}
+
+
+/*
+** A minimal client that hands count messages to a running daemon in
+** batches, to show the framing and measure the local handoff.
+*/
+int sidecarClient(const char *socketPath, long count)
+{
+    const int batch = 64;
+    char frame[SIDECAR_FRAME_HEADER + 64];
+    char *out = (char *)malloc(batch * sizeof(frame));
+    char acks[SIDECAR_ACK_SIZE * 64];
+    size_t ackBytes = 0;
+    long sent = 0;
+    long acked = 0;
+    long failed = 0;
+    histogram *handoff = (histogram *)malloc(sizeof(histogram));
+
+    struct sockaddr_un remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.sun_family = AF_UNIX;
+    strncpy(remote.sun_path, socketPath, sizeof(remote.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((NULL == out) || (NULL == handoff) || (fd < 0) ||
+        (connect(fd, (struct sockaddr *)&remote, sizeof(remote)) != 0))
+    {
+        printf("ERROR: cannot connect to %s\n", socketPath);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        free(out);
+        free(handoff);
+        return -1;
+    }
+    histogramReset(handoff);
+
+    long long start = currentMicros();
+    while (acked < count)
+    {
+        if (sent < count)
+        {
+            size_t used = 0;
+            int n;
+            for (n = 0; (n < batch) && (sent < count); n++, sent++)
+            {
+                int textLength = SNPRINTF(frame + SIDECAR_FRAME_HEADER, 64,
+                    "Sidecar message %ld", sent);
+                putUint32(frame, 5 + textLength);
+                putUint32(frame + 4, (unsigned int)sent);
+                frame[8] = SIDECAR_FORMAT_BODY;
+                memcpy(out + used, frame, SIDECAR_FRAME_HEADER + textLength);
+                used += SIDECAR_FRAME_HEADER + textLength;
+            }
+            /* One write per batch; this is the whole local handoff */
+            long long before = currentMicros();
+            size_t done = 0;
+            while (done < used)
+            {
+                ssize_t wrote = write(fd, out + done, used - done);
+                if (wrote <= 0)
+                {
+                    printf("ERROR: daemon went away\n");
+                    close(fd);
+                    free(out);
+                    free(handoff);
+                    return -1;
+                }
+                done += (size_t)wrote;
+            }
+            histogramRecord(handoff, currentMicros() - before);
+        }
+
+        ssize_t got = read(fd, acks + ackBytes, sizeof(acks) - ackBytes);
+        if (got <= 0)
+        {
+            printf("ERROR: daemon went away\n");
+            break;
+        }
+        ackBytes += (size_t)got;
+        size_t used = 0;
+        while (ackBytes - used >= SIDECAR_ACK_SIZE)
+        {
+            if ((unsigned char)acks[used + 4] != PN_STATUS_ACCEPTED)
+            {
+                failed++;
+            }
+            acked++;
+            used += SIDECAR_ACK_SIZE;
+        }
+        memmove(acks, acks + used, ackBytes - used);
+        ackBytes -= used;
+    }
+
+    long long elapsed = currentMicros() - start;
+    printf("Handed off %ld messages, %ld acked, %ld not accepted, "
+        "%.1f/s end to end\n", sent, acked, failed,
+        (elapsed > 0) ? (acked * 1000000.0 / elapsed) : 0.0);
+    histogramPrint(handoff, "Handoff per 64-message write us");
+    close(fd);
+    free(out);
+    free(handoff);
+    return (0 == failed) ? 0 : -1;
+}
+
+#else
+
+int sidecarDaemon(pn_messenger_t *messenger, pn_message_t *message,
+                  char *address, const char *socketPath)
+{
+    printf("Daemon mode needs Unix domain sockets and Proton-C 0.8 or "
+        "later\n");
+    return -1;
+}
+
+
+int sidecarClient(const char *socketPath, long count)
+{
+    printf("Daemon mode needs Unix domain sockets and Proton-C 0.8 or "
+        "later\n");
+    return -1;
+}
+
+#endif
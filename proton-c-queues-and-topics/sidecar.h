@@ -0,0 +1,61 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __SIDECAR_H
+#define __SIDECAR_H
+
+#include "proton/message.h"
+#include "proton/messenger.h"
+
+/*
+** In daemon mode the sender keeps its messenger, and so its connection
+** to Service Bus, open and accepts messages from local processes over a
+** Unix domain socket. All integers are in network byte order.
+**
+** Client to daemon, one frame per message, any number per write():
+**
+**   4 bytes  length of the rest of the frame
+**   4 bytes  sequence number chosen by the client, echoed in the ack
+**   1 byte   SIDECAR_FORMAT_BODY: payload is sent as a binary body
+**            SIDECAR_FORMAT_MESSAGE: payload is a pn_message_encode()d
+**            message, sent as is apart from its address
+**   n bytes  payload
+**
+** Daemon to client, one ack per message once its outcome is known:
+**
+**   4 bytes  the sequence number from the frame
+**   1 byte   the final pn_status_t, or SIDECAR_STATUS_FAILED if the
+**            message could not even be queued
+**
+** Acks are sent in the order the messages were received.
+*/
+#define SIDECAR_FORMAT_BODY	0
+#define SIDECAR_FORMAT_MESSAGE	1
+#define SIDECAR_STATUS_FAILED	0xFF
+
+#define SIDECAR_FRAME_HEADER	9
+#define SIDECAR_ACK_SIZE	5
+#define SIDECAR_MAX_FRAME	(4 * 1024 * 1024)
+#define SIDECAR_MAX_CLIENTS	64
+
+/* Messages the daemon keeps in flight; also its outgoing window */
+#define SIDECAR_WINDOW		1024
+
+extern int sidecarDaemon(pn_messenger_t *messenger, pn_message_t *message,
+                         char *address, const char *socketPath);
+extern int sidecarClient(const char *socketPath, long count);
+
+#endif /* __SIDECAR_H */
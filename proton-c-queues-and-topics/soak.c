@@ -0,0 +1,547 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+/*
+** Soak test for the sender and receiver. The receiver listens on a local
+** port as a stand-in for Service Bus, the sender sends to it directly,
+** and both run with liballocwatch.so preloaded. Every few seconds the
+** RSS of each process and its allocation and message counters are
+** sampled. Once a process has handled the warm-up messages, the sample
+** is its steady-state baseline; at the end, the test fails if its RSS
+** grew by more than the allowed amount after that, if its live
+** allocations grew by more than a fixed allowance, however many messages
+** it handled, or if it made more allocations per message than the budget.
+**
+** Linux only: it relies on LD_PRELOAD and /proc.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "allocwatch.h"
+
+#define SOAK_DEFAULT_MESSAGES	1000000
+#define SOAK_DEFAULT_BUDGET	50.0	/* allocations per message */
+#define SOAK_DEFAULT_GROWTH	1024	/* kB of steady-state RSS growth */
+#define SOAK_DEFAULT_INTERVAL	5	/* seconds between samples */
+#define SOAK_DEFAULT_PORT	5673
+#define SOAK_DEFAULT_LIVE	256	/* steady-state live allocation growth */
+#define SOAK_LISTEN_TIMEOUT	30	/* seconds for the receiver to listen */
+#define SOAK_LISTEN_POLL	50000	/* microseconds between tries */
+#define SOAK_RECEIVER_GRACE	60	/* seconds to drain after the sender */
+#define SOAK_UNLIMITED		2000000000L
+
+typedef struct soakSample
+{
+    long long messages;
+    long long allocations;    /* allocations and reallocs */
+    long long live;           /* allocations not yet freed */
+    long rss;                 /* kB */
+} soakSample;
+
+typedef struct soakProcess
+{
+    const char *name;
+    pid_t pid;
+    bool running;
+    int status;
+    char statsFile[64];
+    allocStats *stats;
+    bool steady;              /* baseline taken */
+    soakSample baseline;
+    soakSample last;
+    long peakRss;
+} soakProcess;
+
+
+static long rssKb(pid_t pid)
+{
+    char path[64];
+    long pages = 0;
+    long resident = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (NULL == file)
+    {
+        return 0;
+    }
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+    {
+        resident = 0;
+    }
+    fclose(file);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+static int soakStart(soakProcess *process, const char *name, char **argv,
+                     const char *preload)
+{
+    memset(process, 0, sizeof(soakProcess));
+    process->name = name;
+    snprintf(process->statsFile, sizeof(process->statsFile),
+        "/tmp/soak-%s.XXXXXX", name);
+    int fd = mkstemp(process->statsFile);
+    if (fd < 0)
+    {
+        printf("ERROR: cannot create %s\n", process->statsFile);
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(allocStats)) != 0)
+    {
+        printf("ERROR: cannot size %s\n", process->statsFile);
+        close(fd);
+        unlink(process->statsFile);
+        return -1;
+    }
+    void *shared = mmap(NULL, sizeof(allocStats), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == shared)
+    {
+        printf("ERROR: cannot map %s\n", process->statsFile);
+        unlink(process->statsFile);
+        return -1;
+    }
+    process->stats = (allocStats *)shared;
+
+    process->pid = fork();
+    if (process->pid < 0)
+    {
+        printf("ERROR: cannot start %s (%s)\n", argv[0], strerror(errno));
+        return -1;
+    }
+    if (0 == process->pid)
+    {
+        /* Their per-message output would swamp the samples */
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        setenv(ALLOCWATCH_ENV, process->statsFile, 1);
+        setenv("LD_PRELOAD", preload, 1);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    process->running = true;
+    return 0;
+}
+
+
+/*
+** Waits until the receiver accepts connections on port, and returns
+** false if it exits first or is still not listening after
+** SOAK_LISTEN_TIMEOUT seconds.
+*/
+static bool soakWaitListening(soakProcess *receiver, int port)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    time_t deadline = time(NULL) + SOAK_LISTEN_TIMEOUT;
+    while (time(NULL) < deadline)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            printf("ERROR: cannot create a socket (%s)\n", strerror(errno));
+            return false;
+        }
+        int err = connect(fd, (struct sockaddr *)&address, sizeof(address));
+        close(fd);
+        if (0 == err)
+        {
+            return true;
+        }
+        if (waitpid(receiver->pid, &receiver->status, WNOHANG) ==
+            receiver->pid)
+        {
+            receiver->running = false;
+            printf("ERROR: the receiver exited before listening on port "
+                "%d\n", port);
+            return false;
+        }
+        usleep(SOAK_LISTEN_POLL);
+    }
+    printf("ERROR: the receiver is not listening on port %d after %d s\n",
+        port, SOAK_LISTEN_TIMEOUT);
+    return false;
+}
+
+
+static void soakSampleTake(soakProcess *process, long long warmup)
+{
+    soakSample sample;
+    allocStats *stats = process->stats;
+
+    if (!process->running)
+    {
+        return;
+    }
+    /*
+    ** A process that has exited has no RSS left, but its counters are
+    ** final, so keep its last RSS and take them.
+    */
+    sample.rss = rssKb(process->pid);
+    if (0 == sample.rss)
+    {
+        sample.rss = process->last.rss;
+    }
+    sample.messages = stats->messages;
+    sample.allocations = stats->allocations + stats->reallocs;
+    sample.live = stats->allocations - stats->frees;
+    process->last = sample;
+    if (!process->steady && (sample.messages >= warmup))
+    {
+        process->steady = true;
+        process->baseline = sample;
+        process->peakRss = sample.rss;
+    }
+    if (process->steady && (sample.rss > process->peakRss))
+    {
+        process->peakRss = sample.rss;
+    }
+}
+
+
+static void soakPrint(soakProcess *process, long elapsed)
+{
+    soakSample *base = &process->baseline;
+    soakSample *last = &process->last;
+    long long messages = last->messages - base->messages;
+
+    printf("SOAK %6lds %-8s %10lld msgs %8ld kB RSS", elapsed, process->name,
+        last->messages, last->rss);
+    if (process->steady && (messages > 0))
+    {
+        printf(" %7.2f allocs/msg %+8lld live\n",
+            (double)(last->allocations - base->allocations) / messages,
+            last->live - base->live);
+    }
+    else
+    {
+        printf("    (warming up)\n");
+    }
+}
+
+
+/*
+** Notices a process that has exited, taking a last sample first so that
+** it is checked on its final counters.
+*/
+static void soakReap(soakProcess *process, long long warmup, time_t now,
+                     time_t *exited)
+{
+    if (process->running && (waitpid(process->pid, &process->status,
+            WNOHANG) == process->pid))
+    {
+        soakSampleTake(process, warmup);
+        process->running = false;
+        *exited = now;
+    }
+}
+
+
+/*
+** Checks one process against the limits, printing the verdict, and
+** returns whether it passed.
+*/
+static bool soakCheck(soakProcess *process, bool killed, double budget,
+                      long growth, long live)
+{
+    soakSample *base = &process->baseline;
+    soakSample *last = &process->last;
+    long long messages = last->messages - base->messages;
+    bool passed = true;
+
+    if (WIFSIGNALED(process->status) && !killed)
+    {
+        printf("FAIL %s died from signal %d\n", process->name,
+            WTERMSIG(process->status));
+        return false;
+    }
+    if (WIFEXITED(process->status) && (WEXITSTATUS(process->status) != 0))
+    {
+        printf("FAIL %s exited with status %d\n", process->name,
+            WEXITSTATUS(process->status));
+        return false;
+    }
+    if (!process->steady || (messages <= 0))
+    {
+        printf("FAIL %s handled %lld messages, too few to reach a steady "
+            "state\n", process->name, last->messages);
+        return false;
+    }
+
+    double perMessage = (double)(last->allocations - base->allocations) /
+        messages;
+    long long liveGrowth = last->live - base->live;
+    long rssGrowth = process->peakRss - base->rss;
+    printf("%s: %lld steady-state messages, RSS %ld kB -> %ld kB peak "
+        "(%+ld kB), %.2f allocations/message, live allocations %+lld\n",
+        process->name, messages, base->rss, process->peakRss, rssGrowth,
+        perMessage, liveGrowth);
+    if (rssGrowth > growth)
+    {
+        printf("FAIL %s RSS grew by %ld kB, more than %ld kB\n",
+            process->name, rssGrowth, growth);
+        passed = false;
+    }
+    /* A leak keeps growing, so no allowance scales with the messages */
+    if (liveGrowth > live)
+    {
+        printf("FAIL %s live allocations grew by %lld, more than %ld "
+            "(about %.4f per message)\n", process->name, liveGrowth, live,
+            (double)liveGrowth / messages);
+        passed = false;
+    }
+    if (perMessage > budget)
+    {
+        printf("FAIL %s made %.2f allocations per message, budget %.2f\n",
+            process->name, perMessage, budget);
+        passed = false;
+    }
+    return passed;
+}
+
+
+int main(int argc, char **argv)
+{
+    long messages = SOAK_DEFAULT_MESSAGES;
+    long minutes = 0;
+    long long warmup = -1;
+    double budget = SOAK_DEFAULT_BUDGET;
+    long growth = SOAK_DEFAULT_GROWTH;
+    long live = SOAK_DEFAULT_LIVE;
+    int interval = SOAK_DEFAULT_INTERVAL;
+    int port = SOAK_DEFAULT_PORT;
+    char preload[PATH_MAX];
+    int i;
+
+    for (i = 4; i < argc; i++)
+    {
+        if ((0 == strcmp(argv[i], "-messages")) && (i + 1 < argc))
+        {
+            messages = strtol(argv[++i], NULL, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-minutes")) && (i + 1 < argc))
+        {
+            minutes = strtol(argv[++i], NULL, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-warmup")) && (i + 1 < argc))
+        {
+            warmup = strtoll(argv[++i], NULL, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-budget")) && (i + 1 < argc))
+        {
+            budget = strtod(argv[++i], NULL);
+        }
+        else if ((0 == strcmp(argv[i], "-growth")) && (i + 1 < argc))
+        {
+            growth = strtol(argv[++i], NULL, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-live")) && (i + 1 < argc))
+        {
+            live = strtol(argv[++i], NULL, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-interval")) && (i + 1 < argc))
+        {
+            interval = atoi(argv[++i]);
+        }
+        else if ((0 == strcmp(argv[i], "-port")) && (i + 1 < argc))
+        {
+            port = atoi(argv[++i]);
+        }
+        else
+        {
+            argc = 0; /* force the usage message */
+            break;
+        }
+    }
+    if ((messages < 1) || (minutes < 0) || (interval < 1))
+    {
+        argc = 0;
+    }
+
+    if (argc < 4)
+    {
+        printf("Usage: %s sender receiver liballocwatch.so [options]\n",
+            (argc > 0) ? argv[0] : "soak");
+        printf("  -messages n     messages to send (default %d)\n",
+            SOAK_DEFAULT_MESSAGES);
+        printf("  -minutes m      send for m minutes instead of a fixed "
+            "number of messages\n");
+        printf("  -warmup n       messages before the steady state starts "
+            "(default a tenth\n"
+            "                  of -messages, 100000 with -minutes)\n");
+        printf("  -budget a       most allocations allowed per message "
+            "(default %.0f)\n", SOAK_DEFAULT_BUDGET);
+        printf("  -growth kB      most steady-state RSS growth allowed "
+            "(default %d)\n", SOAK_DEFAULT_GROWTH);
+        printf("  -live n         most steady-state growth in live "
+            "allocations allowed\n"
+            "                  (default %d)\n", SOAK_DEFAULT_LIVE);
+        printf("  -interval s     seconds between samples (default %d)\n",
+            SOAK_DEFAULT_INTERVAL);
+        printf("  -port p         local port the receiver listens on "
+            "(default %d)\n", SOAK_DEFAULT_PORT);
+        return 1;
+    }
+
+    /* The children start elsewhere in the path search, so pin it down */
+    if (NULL == realpath(argv[3], preload))
+    {
+        printf("ERROR: cannot find %s\n", argv[3]);
+        return 1;
+    }
+    if (minutes > 0)
+    {
+        messages = SOAK_UNLIMITED;
+    }
+    if (warmup < 0)
+    {
+        warmup = (minutes > 0) ? 100000 : messages / 10;
+    }
+
+    char listen[64];
+    char connect[64];
+    char count[32];
+    snprintf(listen, sizeof(listen), "amqp://~127.0.0.1:%d", port);
+    snprintf(connect, sizeof(connect), "amqp://127.0.0.1:%d", port);
+    snprintf(count, sizeof(count), "%ld", messages);
+    char *receiverArgs[] = { argv[2], "soak", "soak", "soak", "soak",
+        "-url", listen, NULL };
+    char *senderArgs[] = { argv[1], "soak", "soak", "soak", "soak",
+        "-url", connect, "-count", count, NULL };
+
+    soakProcess receiver;
+    soakProcess sender;
+    if (soakStart(&receiver, "receiver", receiverArgs, preload) != 0)
+    {
+        return 1;
+    }
+    if (!soakWaitListening(&receiver, port))
+    {
+        if (receiver.running)
+        {
+            kill(receiver.pid, SIGTERM);
+        }
+        return 1;
+    }
+    if (soakStart(&sender, "sender", senderArgs, preload) != 0)
+    {
+        kill(receiver.pid, SIGTERM);
+        return 1;
+    }
+    if (minutes > 0)
+    {
+        printf("Soaking for %ld minutes\n", minutes);
+    }
+    else
+    {
+        printf("Soaking with %ld messages\n", messages);
+    }
+
+    time_t start = time(NULL);
+    time_t nextSample = start + interval;
+    time_t senderExit = 0;
+    time_t receiverExit = 0;
+    bool senderKilled = false;
+    bool receiverKilled = false;
+    long elapsed = 0;
+    while (receiver.running)
+    {
+        sleep(1);
+        time_t now = time(NULL);
+        elapsed = (long)(now - start);
+        if (now >= nextSample)
+        {
+            nextSample += interval;
+            soakSampleTake(&sender, warmup);
+            soakSampleTake(&receiver, warmup);
+            if (sender.running)
+            {
+                soakPrint(&sender, elapsed);
+            }
+            soakPrint(&receiver, elapsed);
+        }
+
+        if ((minutes > 0) && sender.running && (elapsed >= minutes * 60))
+        {
+            kill(sender.pid, SIGTERM);
+            senderKilled = true;
+        }
+        soakReap(&sender, warmup, now, &senderExit);
+        /*
+        ** The receiver stops on its own once nothing has arrived for its
+        ** receive timeout, but do not wait forever for it to drain.
+        */
+        if (!sender.running && receiver.running &&
+            (now - senderExit > SOAK_RECEIVER_GRACE))
+        {
+            kill(receiver.pid, SIGTERM);
+            receiverKilled = true;
+        }
+        soakReap(&receiver, warmup, now, &receiverExit);
+    }
+    bool receiverEarly = sender.running;
+    if (sender.running)
+    {
+        kill(sender.pid, SIGTERM);
+        waitpid(sender.pid, &sender.status, 0);
+        soakSampleTake(&sender, warmup);
+        sender.running = false;
+        senderKilled = true;
+    }
+
+    printf("Soak ran for %ld s\n", elapsed);
+    bool sendPassed = soakCheck(&sender, senderKilled, budget, growth, live);
+    bool receivePassed = soakCheck(&receiver, receiverKilled, budget, growth,
+        live);
+    bool passed = sendPassed && receivePassed;
+    if (receiverEarly)
+    {
+        printf("FAIL the receiver stopped before the sender finished\n");
+        passed = false;
+    }
+    if (!senderKilled && (receiver.stats->messages != sender.stats->messages))
+    {
+        printf("FAIL the sender put %lld messages but the receiver got "
+            "%lld\n", sender.stats->messages, receiver.stats->messages);
+        passed = false;
+    }
+
+    munmap(sender.stats, sizeof(allocStats));
+    munmap(receiver.stats, sizeof(allocStats));
+    unlink(sender.statsFile);
+    unlink(receiver.statsFile);
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,366 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proton/message.h"
+#include "proton/messenger.h"
+#include "proton/error.h"
+#ifndef PN_VERSION_MAJOR
+#include "proton/version.h"
+#endif
+
+#include "common.h"
+#include "stream.h"
+
+
+size_t fileSource(void *context, char *buffer, size_t size)
+{
+    FILE *file = (FILE *)context;
+    size_t total = 0;
+
+    /* fread can return short counts on pipes, so keep going until EOF */
+    while (total < size)
+    {
+        size_t got = fread(buffer + total, 1, size - total, file);
+        if (0 == got)
+        {
+            break;
+        }
+        total += got;
+    }
+    return total;
+}
+
+
+int fileSink(void *context, pn_uuid_t *streamId, long long offset,
+             const char *data, size_t size, bool last)
+{
+    fileSinkContext *sink = (fileSinkContext *)context;
+    char name[512];
+    char id[UUID_STRING_SIZE];
+
+    formatUuid(streamId, id);
+    if ((sink->file != NULL) &&
+        (memcmp(&sink->streamId, streamId, sizeof(pn_uuid_t)) != 0))
+    {
+        fileSinkClose(sink);
+    }
+    if (NULL == sink->file)
+    {
+        SNPRINTF(name, sizeof(name), "%s.%s", sink->prefix, id);
+        /*
+        ** Open for update rather than truncating, in case this is a late
+        ** chunk for a stream whose LastChunk has already been written.
+        */
+        sink->file = fopen(name, "r+b");
+        if (NULL == sink->file)
+        {
+            sink->file = fopen(name, "w+b");
+        }
+        if (NULL == sink->file)
+        {
+            printf("ERROR: cannot open stream file %s\n", name);
+            return -1;
+        }
+        memcpy(&sink->streamId, streamId, sizeof(pn_uuid_t));
+        sink->bytes = 0;
+        printf("Writing stream %s to %s\n", id, name);
+    }
+
+    if ((FSEEK64(sink->file, offset, SEEK_SET) != 0) ||
+        (fwrite(data, 1, size, sink->file) != size))
+    {
+        printf("ERROR: cannot write %lu bytes at offset %lld of stream %s\n",
+            (unsigned long)size, offset, id);
+        return -1;
+    }
+    sink->bytes += size;
+
+    if (last)
+    {
+        printf("Stream %s complete, %lld bytes in this session\n",
+            id, sink->bytes);
+        fileSinkClose(sink);
+    }
+    return 0;
+}
+
+
+void fileSinkClose(fileSinkContext *context)
+{
+    if (context->file != NULL)
+    {
+        fclose(context->file);
+        context->file = NULL;
+    }
+}
+
+
+static void setupChunk(pn_message_t *message, char *address,
+                       pn_uuid_t *streamId, char *groupId,
+                       pn_sequence_t sequence, long long offset, bool last)
+{
+    pn_message_clear(message);
+    pn_message_set_address(message, address);
+
+    pn_data_t *header = pn_message_properties(message);
+
+    pn_data_put_map(header);
+    pn_data_enter(header);
+
+    pn_data_put_string(header, pn_bytes(strlen("Originator"), "Originator"));
+    pn_data_put_string(header, pn_bytes(strlen("Proton-C"), "Proton-C"));
+
+    pn_data_put_string(header, pn_bytes(strlen("MessageType"), "MessageType"));
+    pn_data_put_string(header, pn_bytes(strlen("StreamChunk"), "StreamChunk"));
+
+    pn_data_put_string(header, pn_bytes(strlen("StreamId"), "StreamId"));
+    pn_data_put_uuid(header, *streamId);
+
+    pn_data_put_string(header, pn_bytes(strlen("ChunkOffset"), "ChunkOffset"));
+    pn_data_put_long(header, offset);
+
+    pn_data_put_string(header, pn_bytes(strlen("LastChunk"), "LastChunk"));
+    pn_data_put_bool(header, last);
+
+    pn_data_exit(header);
+
+    pn_message_set_content_type(message, "application/octet-stream");
+
+    /*
+    ** The group id and sequence are not needed by this sample's receiver,
+    ** which relies on ChunkOffset, but they let a session-aware consumer
+    ** reassemble the stream as well.
+    */
+    pn_message_set_group_id(message, groupId);
+    pn_message_set_group_sequence(message, sequence);
+}
+
+
+#if (PN_VERSION_MINOR > 7)
+/*
+** Retires chunks from the front of the window as their outcomes arrive,
+** working the messenger until no more than keep are still in flight.
+** Returns the number of chunks which the broker did not accept.
+*/
+static int streamRetire(pn_messenger_t *messenger, pn_tracker_t *trackers,
+                        int *head, int *inFlight, int keep)
+{
+    int failures = 0;
+
+    while (*inFlight > 0)
+    {
+        pn_tracker_t tracker = trackers[*head];
+        pn_status_t status = pn_messenger_status(messenger, tracker);
+        if (!isFinalStatus(status))
+        {
+            if (*inFlight <= keep)
+            {
+                break;
+            }
+            int err = pn_messenger_work(messenger,
+                pn_messenger_get_timeout(messenger));
+            if ((err < 0) && (err != PN_INPROGRESS))
+            {
+                /* Timed out or lost the connection: give up on the rest */
+                protonError(err, "pn_messenger_work", messenger);
+                failures += *inFlight;
+                *inFlight = 0;
+                break;
+            }
+            continue;
+        }
+        if (PN_STATUS_ACCEPTED != status)
+        {
+            printf("Chunk status %d\n", (int)status);
+            failures++;
+        }
+        pn_messenger_settle(messenger, tracker, 0);
+        *head = (*head + 1) % STREAM_WINDOW;
+        (*inFlight)--;
+    }
+    return failures;
+}
+#else
+/*
+** Sends the chunks queued since the last flush and checks their outcomes.
+** Returns the number of chunks which the broker did not accept.
+*/
+static int streamFlush(pn_messenger_t *messenger, pn_tracker_t *trackers,
+                       int count)
+{
+    pn_status_t statuses[STREAM_WINDOW];
+    int failures = flushTracked(messenger, trackers, count, statuses, NULL);
+    int i;
+
+    for (i = 0; (failures > 0) && (i < count); i++)
+    {
+        if (PN_STATUS_ACCEPTED != statuses[i])
+        {
+            printf("Chunk status %d\n", (int)statuses[i]);
+        }
+    }
+    return failures;
+}
+#endif
+
+
+int streamSend(pn_messenger_t *messenger, pn_message_t *message,
+               char *address, streamSource source, void *context,
+               size_t chunkSize)
+{
+    pn_tracker_t trackers[STREAM_WINDOW];
+    int head = 0;
+    int pending = 0;
+    int failures = 0;
+    long long offset = 0;
+    pn_sequence_t sequence = 0;
+    bool last = false;
+    pn_uuid_t streamId;
+    char groupId[UUID_STRING_SIZE];
+
+    /*
+    ** The one and only chunk buffer. pn_messenger_put() encodes the message
+    ** into the messenger's own buffers, so it can be refilled right away.
+    */
+    char *buffer = (char *)malloc(chunkSize);
+    if (NULL == buffer)
+    {
+        printf("ERROR: cannot allocate %lu byte chunk buffer\n",
+            (unsigned long)chunkSize);
+        return -1;
+    }
+
+    generateUuid(&streamId);
+    formatUuid(&streamId, groupId);
+    printf("Streaming with id %s in chunks of %lu bytes\n", groupId,
+        (unsigned long)chunkSize);
+
+    while (!last)
+    {
+        size_t length = source(context, buffer, chunkSize);
+
+        /* A short read ends the stream; the final chunk may be empty */
+        last = (length < chunkSize);
+        setupChunk(message, address, &streamId, groupId, sequence, offset,
+            last);
+        pn_data_put_binary(pn_message_body(message),
+            pn_bytes(length, buffer));
+
+#if (PN_VERSION_MINOR > 7)
+        /*
+        ** Keep the window full: each chunk only waits for the oldest one
+        ** in flight, not for the whole window to drain.
+        */
+        failures += streamRetire(messenger, trackers, &head, &pending,
+            STREAM_WINDOW - 1);
+#endif
+        int err = pn_messenger_put(messenger, message);
+        if (err != 0)
+        {
+            protonError(err, "pn_messenger_put", messenger);
+            failures++;
+            break;
+        }
+        trackers[(head + pending++) % STREAM_WINDOW] =
+            pn_messenger_outgoing_tracker(messenger);
+        offset += length;
+        sequence++;
+
+#if (PN_VERSION_MINOR > 7)
+        if ((0 == sequence % STREAM_WINDOW) || last)
+        {
+            printf("Streamed %lld bytes in %u chunks\n", offset,
+                (unsigned)sequence);
+        }
+#else
+        /* Without pn_messenger_work(), the window drains as a whole */
+        if ((STREAM_WINDOW == pending) || last)
+        {
+            failures += streamFlush(messenger, trackers, pending);
+            pending = 0;
+            printf("Streamed %lld bytes in %u chunks\n", offset,
+                (unsigned)sequence);
+        }
+#endif
+    }
+#if (PN_VERSION_MINOR > 7)
+    failures += streamRetire(messenger, trackers, &head, &pending, 0);
+#else
+    if (pending > 0)
+    {
+        failures += streamFlush(messenger, trackers, pending);
+    }
+#endif
+
+    /* Leave the message empty rather than pointing at the freed buffer */
+    pn_message_clear(message);
+    free(buffer);
+
+    printf("Final stream status is: %s\n",
+        (0 == failures) ? "successful!" : "some chunks failed");
+    return (0 == failures) ? 0 : -1;
+}
+
+
+/*
+** Returns 1 if the message was a stream chunk and the sink took it, 0 if
+** it is not a stream chunk at all, and -1 if it is a chunk that could not
+** be consumed and should be rejected.
+*/
+int streamReceiveChunk(pn_message_t *message, streamSink sink, void *context)
+{
+    pn_data_t *properties = pn_message_properties(message);
+    pn_uuid_t streamId;
+    long long offset;
+    bool last = false;
+
+    if (!findProperty(properties, "StreamId") ||
+        (pn_data_type(properties) != PN_UUID))
+    {
+        return 0;
+    }
+    streamId = pn_data_get_uuid(properties);
+
+    if (!findProperty(properties, "ChunkOffset") ||
+        (pn_data_type(properties) != PN_LONG))
+    {
+        return 0;
+    }
+    offset = pn_data_get_long(properties);
+
+    if (findProperty(properties, "LastChunk") &&
+        (PN_BOOL == pn_data_type(properties)))
+    {
+        last = pn_data_get_bool(properties);
+    }
+    pn_data_rewind(properties);
+
+    /* Take the chunk straight out of the decoded body, no formatting */
+    pn_data_t *body = pn_message_body(message);
+    pn_data_rewind(body);
+    if (!pn_data_next(body) || (pn_data_type(body) != PN_BINARY))
+    {
+        printf("Stream chunk body is not binary\n");
+        return -1;
+    }
+    pn_bytes_t chunk = pn_data_get_binary(body);
+
+    return (0 == sink(context, &streamId, offset, chunk.start, chunk.size,
+        last)) ? 1 : -1;
+}
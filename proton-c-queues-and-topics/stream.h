@@ -0,0 +1,71 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __STREAM_H
+#define __STREAM_H
+
+#include <stdio.h>
+#include "proton/message.h"
+#include "proton/messenger.h"
+
+/*
+** A large payload is sent as a sequence of chunk messages which share a
+** StreamId. Each chunk carries its byte offset so that the receiver can
+** write it straight to its final position, and the final chunk (which may
+** be empty) is flagged with LastChunk. Only one chunk buffer is allocated
+** on each side, so memory use does not depend on the payload size.
+**
+** The Standard tier limits a message to 256 KB, header and properties
+** included, so the default chunk leaves room for those below the limit.
+*/
+#define STREAM_DEFAULT_CHUNK	(192 * 1024)
+#define STREAM_MAX_CHUNK	(16 * 1024 * 1024)
+
+/* Number of chunks in flight at once, on both the send and receive side */
+#define STREAM_WINDOW		8
+
+/*
+** Fills buffer with up to size bytes and returns the number of bytes
+** written. Returning less than size means the source is exhausted.
+*/
+typedef size_t (*streamSource)(void *context, char *buffer, size_t size);
+
+/*
+** Consumes one chunk. Returns 0 on success, nonzero to reject the chunk.
+*/
+typedef int (*streamSink)(void *context, pn_uuid_t *streamId, long long offset,
+                          const char *data, size_t size, bool last);
+
+typedef struct fileSinkContext
+{
+    const char *prefix;
+    pn_uuid_t streamId;
+    FILE *file;
+    long long bytes;
+} fileSinkContext;
+
+extern size_t fileSource(void *context, char *buffer, size_t size);
+extern int fileSink(void *context, pn_uuid_t *streamId, long long offset,
+                    const char *data, size_t size, bool last);
+extern void fileSinkClose(fileSinkContext *context);
+
+extern int streamSend(pn_messenger_t *messenger, pn_message_t *message,
+                      char *address, streamSource source, void *context,
+                      size_t chunkSize);
+extern int streamReceiveChunk(pn_message_t *message, streamSink sink,
+                              void *context);
+
+#endif /* __STREAM_H */
@@ -0,0 +1,260 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "timerwheel.h"
+
+#define WHEEL_NONE	0xFFFFFFFFu
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+#define WHEEL_INITIAL	1024
+
+
+int timerWheelInit(timerWheel *wheel, long long now)
+{
+    memset(wheel, 0, sizeof(timerWheel));
+    memset(wheel->heads, 0xFF, sizeof(wheel->heads));
+    memset(wheel->tails, 0xFF, sizeof(wheel->tails));
+    wheel->now = now;
+    wheel->readyHead = WHEEL_NONE;
+    wheel->readyTail = WHEEL_NONE;
+    wheel->freeList = WHEEL_NONE;
+    return 0;
+}
+
+
+void timerWheelFree(timerWheel *wheel)
+{
+    free(wheel->entries);
+    wheel->entries = NULL;
+    wheel->capacity = 0;
+    wheel->count = 0;
+}
+
+
+static void append(timerWheel *wheel, unsigned int *head, unsigned int *tail,
+                   unsigned int index)
+{
+    wheel->entries[index].next = WHEEL_NONE;
+    if (WHEEL_NONE == *tail)
+    {
+        *head = index;
+    }
+    else
+    {
+        wheel->entries[*tail].next = index;
+    }
+    *tail = index;
+}
+
+
+/*
+** Puts an entry at the lowest level whose slots still share all higher
+** bits with the clock; its slot there is the due time's bits for that
+** level, which the clock reaches exactly when the entry must move down.
+** Anything further out goes in the top level slot for its due time,
+** which the clock reaches no later than that, and is placed again then.
+*/
+static void place(timerWheel *wheel, unsigned int index)
+{
+    long long due = wheel->entries[index].due;
+    int level;
+
+    if (due <= wheel->now)
+    {
+        append(wheel, &wheel->readyHead, &wheel->readyTail, index);
+        return;
+    }
+    for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    {
+        int shift = WHEEL_BITS * (level + 1);
+        if ((due >> shift) == (wheel->now >> shift))
+        {
+            int slot = (int)(due >> (WHEEL_BITS * level)) & WHEEL_MASK;
+            append(wheel, &wheel->heads[level][slot],
+                &wheel->tails[level][slot], index);
+            wheel->levelCounts[level]++;
+            return;
+        }
+    }
+
+    level = WHEEL_LEVELS - 1;
+    int slot = (int)(due >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    append(wheel, &wheel->heads[level][slot], &wheel->tails[level][slot],
+        index);
+    wheel->levelCounts[level]++;
+}
+
+
+int timerWheelAdd(timerWheel *wheel, long long due, void *data)
+{
+    if (WHEEL_NONE == wheel->freeList)
+    {
+        unsigned int capacity = (0 == wheel->capacity) ? WHEEL_INITIAL :
+            wheel->capacity * 2;
+        unsigned int i;
+        if (capacity <= wheel->capacity || capacity >= WHEEL_NONE)
+        {
+            return -1;
+        }
+        timerEntry *entries = (timerEntry *)realloc(wheel->entries,
+            capacity * sizeof(timerEntry));
+        if (NULL == entries)
+        {
+            return -1;
+        }
+        for (i = wheel->capacity; i < capacity; i++)
+        {
+            entries[i].next = (i + 1 < capacity) ? i + 1 : wheel->freeList;
+        }
+        wheel->freeList = wheel->capacity;
+        wheel->entries = entries;
+        wheel->capacity = capacity;
+    }
+
+    unsigned int index = wheel->freeList;
+    wheel->freeList = wheel->entries[index].next;
+    wheel->entries[index].due = due;
+    wheel->entries[index].data = data;
+    place(wheel, index);
+    wheel->count++;
+    return 0;
+}
+
+
+static void cascade(timerWheel *wheel, int level, int slot)
+{
+    unsigned int index = wheel->heads[level][slot];
+    wheel->heads[level][slot] = WHEEL_NONE;
+    wheel->tails[level][slot] = WHEEL_NONE;
+    while (index != WHEEL_NONE)
+    {
+        unsigned int next = wheel->entries[index].next;
+        wheel->levelCounts[level]--;
+        place(wheel, index);
+        index = next;
+    }
+}
+
+
+/*
+** Moves the clock forward to now. The clock only needs to stop where
+** the lowest level holding entries turns to its next slot, so it steps
+** one tick at a time while level 0 is busy and skips ahead otherwise.
+*/
+void timerWheelAdvance(timerWheel *wheel, long long now)
+{
+    while (wheel->now < now)
+    {
+        int level;
+
+        for (level = 0; level < WHEEL_LEVELS; level++)
+        {
+            if (wheel->levelCounts[level] != 0)
+            {
+                break;
+            }
+        }
+        if (WHEEL_LEVELS == level)
+        {
+            /* Nothing pending in the slots at all */
+            wheel->now = now;
+            break;
+        }
+        int shift = WHEEL_BITS * level;
+        long long next = ((wheel->now >> shift) + 1) << shift;
+        if (next > now)
+        {
+            wheel->now = now;
+            break;
+        }
+        wheel->now = next;
+
+        for (level = WHEEL_LEVELS - 1; level > 0; level--)
+        {
+            int shift = WHEEL_BITS * level;
+            if (0 == (wheel->now & ((1LL << shift) - 1)))
+            {
+                cascade(wheel, level, (int)(wheel->now >> shift) & WHEEL_MASK);
+            }
+        }
+        cascade(wheel, 0, (int)wheel->now & WHEEL_MASK);
+    }
+}
+
+
+/*
+** Takes the next expired entry, in due order to the millisecond, or
+** returns false if none has expired.
+*/
+bool timerWheelNext(timerWheel *wheel, void **data)
+{
+    unsigned int index = wheel->readyHead;
+    if (WHEEL_NONE == index)
+    {
+        return false;
+    }
+    wheel->readyHead = wheel->entries[index].next;
+    if (WHEEL_NONE == wheel->readyHead)
+    {
+        wheel->readyTail = WHEEL_NONE;
+    }
+    *data = wheel->entries[index].data;
+    wheel->entries[index].next = wheel->freeList;
+    wheel->freeList = index;
+    wheel->count--;
+    return true;
+}
+
+
+/*
+** Returns a time before which nothing expires: the exact due time when
+** the next entry is at level 0, otherwise the time its slot moves down.
+** Returns -1 if the wheel is empty.
+*/
+long long timerWheelNextDue(timerWheel *wheel)
+{
+    int level;
+
+    if (wheel->readyHead != WHEEL_NONE)
+    {
+        return wheel->now;
+    }
+    if (0 == wheel->count)
+    {
+        return -1;
+    }
+    for (level = 0; level < WHEEL_LEVELS; level++)
+    {
+        int shift = WHEEL_BITS * level;
+        long long current = wheel->now >> shift;
+        long long offset;
+        if (0 == wheel->levelCounts[level])
+        {
+            continue;
+        }
+        for (offset = 1; offset <= WHEEL_SLOTS; offset++)
+        {
+            if (wheel->heads[level][(current + offset) & WHEEL_MASK] !=
+                WHEEL_NONE)
+            {
+                return (current + offset) << shift;
+            }
+        }
+    }
+    return wheel->now;
+}
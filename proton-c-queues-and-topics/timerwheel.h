@@ -0,0 +1,69 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __TIMERWHEEL_H
+#define __TIMERWHEEL_H
+
+#include <stddef.h>
+#include "proton/types.h"
+
+/*
+** A hierarchical timer wheel with millisecond ticks: four levels of 256
+** slots each cover 2^32 ms, about 49 days, and anything due later waits
+** in the top level and is looked at again each time the clock passes it.
+** An entry sits at the lowest level whose span still reaches its due
+** time. When the wheel's clock enters a slot of a higher level, that
+** slot's entries are moved down, so each entry moves at most four times
+** in total. Adding and expiring entries take constant time no matter
+** how many are pending.
+**
+** Entries live in one array and are linked by index. Each one costs 24
+** bytes on 64-bit systems (20 plus padding), so the wheel can hold
+** millions of pending entries without calling malloc for each one.
+*/
+#define WHEEL_LEVELS	4
+#define WHEEL_BITS	8
+#define WHEEL_SLOTS	(1 << WHEEL_BITS)
+
+typedef struct timerEntry
+{
+    long long due;        /* milliseconds, on the caller's clock */
+    void *data;
+    unsigned int next;
+} timerEntry;
+
+typedef struct timerWheel
+{
+    long long now;        /* everything due by now is in the ready list */
+    unsigned int heads[WHEEL_LEVELS][WHEEL_SLOTS];
+    unsigned int tails[WHEEL_LEVELS][WHEEL_SLOTS];
+    size_t levelCounts[WHEEL_LEVELS];
+    unsigned int readyHead;
+    unsigned int readyTail;
+    timerEntry *entries;
+    unsigned int capacity;
+    unsigned int freeList;
+    size_t count;
+} timerWheel;
+
+extern int timerWheelInit(timerWheel *wheel, long long now);
+extern void timerWheelFree(timerWheel *wheel);
+extern int timerWheelAdd(timerWheel *wheel, long long due, void *data);
+extern void timerWheelAdvance(timerWheel *wheel, long long now);
+extern bool timerWheelNext(timerWheel *wheel, void **data);
+extern long long timerWheelNextDue(timerWheel *wheel);
+
+#endif /* __TIMERWHEEL_H */
@@ -0,0 +1,239 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "proton/message.h"
+#include "proton/error.h"
+
+#include "common.h"
+#include "trace.h"
+
+/* Writes go through a large stdio buffer, so capture costs no syscalls */
+#define TRACE_WRITE_BUFFER	(1024 * 1024)
+
+
+traceWriter *traceCreate(const char *fileName)
+{
+    traceWriter *writer = (traceWriter *)calloc(1, sizeof(traceWriter));
+    if (NULL == writer)
+    {
+        return NULL;
+    }
+    writer->file = fopen(fileName, "wb");
+    if (NULL == writer->file)
+    {
+        printf("ERROR: cannot create trace file %s\n", fileName);
+        free(writer);
+        return NULL;
+    }
+    setvbuf(writer->file, NULL, _IOFBF, TRACE_WRITE_BUFFER);
+    fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, writer->file);
+    writer->capacity = 4096;
+    writer->buffer = (char *)malloc(writer->capacity);
+    if (NULL == writer->buffer)
+    {
+        printf("ERROR: cannot allocate the trace buffer\n");
+        fclose(writer->file);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+
+int traceWrite(traceWriter *writer, pn_message_t *message)
+{
+    char header[TRACE_RECORD_HEADER];
+    long long now = currentMicros();
+    size_t size;
+    int err;
+
+    for (;;)
+    {
+        size = writer->capacity;
+        err = pn_message_encode(message, writer->buffer, &size);
+        if ((err != PN_OVERFLOW) || (writer->capacity >= TRACE_MAX_MESSAGE))
+        {
+            break;
+        }
+        char *bigger = (char *)realloc(writer->buffer, writer->capacity * 2);
+        if (NULL == bigger)
+        {
+            break;
+        }
+        writer->buffer = bigger;
+        writer->capacity *= 2;
+    }
+    if (err != 0)
+    {
+        printf("ERROR: cannot encode message for trace (%d)\n", err);
+        return err;
+    }
+
+    if (0 == writer->records)
+    {
+        writer->first = now;
+    }
+    long long arrival = now - writer->first;
+    unsigned int length = (unsigned int)size;
+    memcpy(header, &arrival, 8);
+    memcpy(header + 8, &length, 4);
+    if ((fwrite(header, 1, TRACE_RECORD_HEADER, writer->file) !=
+            TRACE_RECORD_HEADER) ||
+        (fwrite(writer->buffer, 1, size, writer->file) != size))
+    {
+        printf("ERROR: cannot write to trace file\n");
+        return PN_ERR;
+    }
+    writer->records++;
+    return 0;
+}
+
+
+void traceClose(traceWriter *writer)
+{
+    if (NULL == writer)
+    {
+        return;
+    }
+    printf("Captured %lld messages\n", writer->records);
+    fclose(writer->file);
+    free(writer->buffer);
+    free(writer);
+}
+
+
+int traceOpen(traceReader *reader, const char *fileName)
+{
+    memset(reader, 0, sizeof(traceReader));
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER size;
+    reader->fileHandle = file;
+    if ((INVALID_HANDLE_VALUE == file) || !GetFileSizeEx(file, &size))
+    {
+        printf("ERROR: cannot open trace file %s\n", fileName);
+        traceUnmap(reader);
+        return -1;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    reader->base = (NULL == mapping) ? NULL :
+        (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    reader->size = (size_t)size.QuadPart;
+    reader->mappingHandle = mapping;
+#else
+    struct stat info;
+    reader->fd = open(fileName, O_RDONLY);
+    if ((reader->fd < 0) || (fstat(reader->fd, &info) != 0))
+    {
+        printf("ERROR: cannot open trace file %s\n", fileName);
+        traceUnmap(reader);
+        return -1;
+    }
+    reader->size = (size_t)info.st_size;
+    reader->base = (const char *)mmap(NULL, reader->size, PROT_READ,
+        MAP_PRIVATE, reader->fd, 0);
+    if (MAP_FAILED == (void *)reader->base)
+    {
+        reader->base = NULL;
+    }
+    else
+    {
+        /* Replay walks the file once, front to back */
+        madvise((void *)reader->base, reader->size, MADV_SEQUENTIAL);
+    }
+#endif
+    if ((NULL == reader->base) || (reader->size < TRACE_MAGIC_SIZE) ||
+        (memcmp(reader->base, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0))
+    {
+        printf("ERROR: %s is not a trace file\n", fileName);
+        traceUnmap(reader);
+        return -1;
+    }
+    reader->offset = TRACE_MAGIC_SIZE;
+    return 0;
+}
+
+
+/*
+** Returns the next record, pointing straight into the mapped file, or
+** false at the end of the trace (or at a truncated record).
+*/
+bool traceNext(traceReader *reader, long long *arrival, const char **bytes,
+               size_t *length)
+{
+    unsigned int size;
+
+    if (reader->size - reader->offset < TRACE_RECORD_HEADER)
+    {
+        return false;
+    }
+    memcpy(arrival, reader->base + reader->offset, 8);
+    memcpy(&size, reader->base + reader->offset + 8, 4);
+    if (reader->size - reader->offset - TRACE_RECORD_HEADER < size)
+    {
+        printf("Trace ends with a truncated record, ignoring it\n");
+        return false;
+    }
+    *bytes = reader->base + reader->offset + TRACE_RECORD_HEADER;
+    *length = size;
+    reader->offset += TRACE_RECORD_HEADER + size;
+    return true;
+}
+
+
+void traceUnmap(traceReader *reader)
+{
+#ifdef _WIN32
+    if (reader->base != NULL)
+    {
+        UnmapViewOfFile(reader->base);
+    }
+    if (reader->mappingHandle != NULL)
+    {
+        CloseHandle((HANDLE)reader->mappingHandle);
+    }
+    if ((reader->fileHandle != NULL) &&
+        (reader->fileHandle != INVALID_HANDLE_VALUE))
+    {
+        CloseHandle((HANDLE)reader->fileHandle);
+    }
+#else
+    if (reader->base != NULL)
+    {
+        munmap((void *)reader->base, reader->size);
+    }
+    if (reader->fd >= 0)
+    {
+        close(reader->fd);
+    }
+#endif
+    memset(reader, 0, sizeof(traceReader));
+#ifndef _WIN32
+    reader->fd = -1;
+#endif
+}
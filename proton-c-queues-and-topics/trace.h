@@ -0,0 +1,69 @@
+/*
+ *  Copyright 2014 Microsoft Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdio.h>
+#include "proton/message.h"
+
+/*
+** Trace file format, in the byte order of the machine that wrote it:
+**
+**   header  8 bytes  TRACE_MAGIC
+**   record  8 bytes  arrival time, microseconds since the first record
+**           4 bytes  length of the encoded message
+**           n bytes  the message exactly as pn_message_encode() wrote it
+**
+** Records are not padded, so readers must not assume any alignment.
+*/
+#define TRACE_MAGIC		"SBTRACE1"
+#define TRACE_MAGIC_SIZE	8
+#define TRACE_RECORD_HEADER	12
+#define TRACE_MAX_MESSAGE	(256 * 1024 * 1024)
+
+typedef struct traceWriter
+{
+    FILE *file;
+    char *buffer;         /* reused encode buffer, grows as needed */
+    size_t capacity;
+    long long first;      /* currentMicros() of the first record */
+    long long records;
+} traceWriter;
+
+typedef struct traceReader
+{
+    const char *base;     /* the whole file, memory mapped */
+    size_t size;
+    size_t offset;
+#ifdef _WIN32
+    void *fileHandle;
+    void *mappingHandle;
+#else
+    int fd;
+#endif
+} traceReader;
+
+extern traceWriter *traceCreate(const char *fileName);
+extern int traceWrite(traceWriter *writer, pn_message_t *message);
+extern void traceClose(traceWriter *writer);
+
+extern int traceOpen(traceReader *reader, const char *fileName);
+extern bool traceNext(traceReader *reader, long long *arrival,
+                      const char **bytes, size_t *length);
+extern void traceUnmap(traceReader *reader);
+
+#endif /* __TRACE_H */